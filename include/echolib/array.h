@@ -1,6 +1,9 @@
 #ifndef __ECHOLIB_ARRAY_H
 #define __ECHOLIB_ARRAY_H
 
+#include <list>
+#include <cassert>
+
 #include <echolib/client.h>
 #include <echolib/datatypes.h>
 
@@ -14,12 +17,25 @@ using namespace echolib;
 
 namespace echolib {
 
-enum DataType { UINT8 = 1, UINT16 = 2, UINT32 = 3, INT8 = 4, INT16 = 5, INT32 = 6, FLOAT32 = 10, FLOAT64 = 11 };
+// BIT tensors are packed eight elements per byte in row-major order, most significant bit first (like numpy.packbits)
+enum DataType { UINT8 = 1, UINT16 = 2, UINT32 = 3, INT8 = 4, INT16 = 5, INT32 = 6, UINT64 = 7, INT64 = 8, BOOL = 9,
+    FLOAT32 = 10, FLOAT64 = 11, FLOAT16 = 12, BFLOAT16 = 13, BIT = 14 };
 
 class ArrayBuffer;
 
 typedef std::function<void()> DescructorCallback;
 
+// Default alignment of allocated array data, a cache line
+#define ARRAY_ALIGNMENT 64
+// Allocations of at least this size are backed by transparent huge pages
+#define ARRAY_HUGE_PAGE_THRESHOLD (2 * 1024 * 1024)
+#define ARRAY_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Large tensors are padded in messages so that their data starts at a multiple of this many bytes
+#define TENSOR_DATA_ALIGNMENT 64
+#define TENSOR_ALIGNMENT_THRESHOLD 1024
+#define TENSOR_PADDING_FLAG 0x80
+
 class Array {
 public:
 
@@ -32,6 +48,30 @@ public:
     virtual size_t get_size() const;
     uchar* get_data() const;
 
+    /**
+     * Returns false if the data is not stored as a single block of get_size() bytes starting at get_data().
+     */
+    virtual bool is_contiguous() const;
+
+    /**
+     * Copies a part of the data in its packed (contiguous) layout, returns the number of bytes copied.
+     */
+    virtual size_t copy_data(size_t position, uchar* buffer, size_t length) const;
+
+    /**
+     * Sets the alignment of data allocated by arrays, must be a power of two.
+     */
+    static void set_alignment(size_t alignment);
+
+    static size_t get_alignment();
+
+    /**
+     * Sets the size from which allocations are advised to use huge pages, zero disables them.
+     */
+    static void set_huge_page_threshold(size_t threshold);
+
+    static size_t get_huge_page_threshold();
+
 protected:
 
     size_t size;
@@ -44,7 +84,19 @@ typedef shared_ptr<Array> SharedArray;
 
 template <> inline string get_type_identifier<SharedArray>() { return string("array"); }
 
-class Tensor: public Array {
+class Tensor;
+
+typedef shared_ptr<Tensor> SharedTensor;
+
+/**
+ * Conversions between float32 and 16-bit floats with rounding to nearest even, vectorized if the CPU supports it.
+ */
+void convert_float32_to_float16(const float* src, uint16_t* dst, size_t count);
+void convert_float16_to_float32(const uint16_t* src, float* dst, size_t count);
+void convert_float32_to_bfloat16(const float* src, uint16_t* dst, size_t count);
+void convert_bfloat16_to_float32(const uint16_t* src, float* dst, size_t count);
+
+class Tensor: public Array, public std::enable_shared_from_this<Tensor> {
 public:
 
     Tensor();
@@ -53,23 +105,24 @@ public:
 
     Tensor(echolib::any_container<size_t> dimensions, DataType dtype, uchar* data, DescructorCallback callback);
 
+    /**
+     * Wraps strided data, strides are given in bytes for every dimension and may be negative.
+     */
+    Tensor(echolib::any_container<size_t> dimensions, DataType dtype, uchar* data, echolib::any_container<ssize_t> strides, DescructorCallback callback);
+
 #ifdef __ECHOLIB_HAS_OPENCV
     static DataType decode_ocvtype(int cvtype);
 
     static int encode_ocvtype(DataType dtype);
 
+    /**
+     * Shares the data of a Mat by holding a reference to it, non-continuous Mats are wrapped with strides.
+     */
     Tensor(cv::Mat source);
 
     template<typename T, int m, int n> Tensor(const cv::Matx<T, m, n>& source) : Tensor({source.rows, source.cols}, decode_ocvtype(cv::DataType<T>::depth)) {
-        
-        T* ptr = (T*) get_data();
 
-        for (int i = 0; i < m; i++) {
-            for (int j = 0; j < n; j++) {
-                ptr[0] = source(i, j);
-                ptr++;
-            }
-        }
+        memcpy(get_data(), source.val, sizeof(T) * m * n);
 
     }
 
@@ -79,23 +132,18 @@ public:
 
         assert(ndims() == 2 && m == shape(0) && n == shape(1) && encode_ocvtype(dtype) == reftype);
 
-        T* ptr = (T*) get_data();
-
         cv::Matx<T, m, n> dst;
 
-        size_t k = 0;
-
-        for (int i = 0; i < m; i++) {
-            for (int j = 0; j < n; j++) {
-                dst(i, j) = data[k];
-                k++;
-            }
-        }
+        copy_data(0, (uchar*) dst.val, sizeof(T) * m * n);
 
         return dst;
 
     }
 
+    /**
+     * Returns a Mat header over the tensor data. If the tensor is owned by a shared pointer the Mat keeps it alive,
+     * otherwise the Mat is only valid as long as the tensor.
+     */
     cv::Mat asMat() const;
 
 #endif
@@ -110,22 +158,145 @@ public:
 
     uchar ndims() const;
 
+    ssize_t stride(size_t i) const;
+
+    const std::vector<ssize_t> strides() const;
+
+    virtual bool is_contiguous() const;
+
+    virtual size_t copy_data(size_t position, uchar* buffer, size_t length) const;
+
+    /**
+     * Returns a view of every step-th element from start (inclusive) to end (exclusive) along a dimension. Views
+     * share the data and keep this tensor alive, so the tensor has to be owned by a shared pointer.
+     */
+    SharedTensor slice(size_t dimension, size_t start, size_t end, size_t step = 1) const;
+
+    /**
+     * Returns a view of a single element along a dimension, the dimension is removed.
+     */
+    SharedTensor select(size_t dimension, size_t index) const;
+
+    /**
+     * Returns a view of a region in the leading dimensions, e.g. {y, x} and {height, width} for an image.
+     */
+    SharedTensor crop(echolib::any_container<size_t> offset, echolib::any_container<size_t> size) const;
+
     uchar get_bytes();
 
+    /**
+     * Returns the size of an element in bytes, zero for BIT.
+     */
     static size_t get_type_bytes(DataType dtype);
 
+    /**
+     * Returns the number of bytes needed to store a number of elements.
+     */
+    static size_t get_storage_size(DataType dtype, size_t elements);
+
+    /**
+     * Converts between float32 and the 16-bit float types and between BOOL and BIT, returns this tensor if the
+     * type is the same.
+     */
+    SharedTensor convert(DataType dtype) const;
+
 protected:
 
     vector<size_t> dimensions;
 
+    // Empty for contiguous data
+    vector<ssize_t> steps;
+
     DataType dtype;
 
-};
+private:
 
-typedef shared_ptr<Tensor> SharedTensor;
+    SharedTensor view(uchar* origin, vector<size_t> dimensions, vector<ssize_t> strides) const;
+
+#ifdef __ECHOLIB_HAS_OPENCV
+    cv::Mat share_data(cv::Mat& mat) const;
+#endif
+
+};
 
 template <> inline string get_type_identifier<SharedTensor>() { return string("tensor"); }
 
+class TensorPool;
+
+typedef shared_ptr<TensorPool> SharedTensorPool;
+
+// Default limits of a pool, the number of free buffers kept per shape and the number of bytes kept in total
+#define TENSOR_POOL_HIGH_WATER 4
+#define TENSOR_POOL_MAX_BYTES (64 * 1024 * 1024)
+
+/**
+ * Recycles tensor buffers for recurring shapes. Tensors handed out by a pool return their buffer to it when they are
+ * released, buffers above the per-shape high-water mark (or released after the pool is gone) are freed. When the
+ * total limit is reached the buffers of the least recently used shapes are freed first.
+ */
+class TensorPool: public std::enable_shared_from_this<TensorPool> {
+public:
+
+    TensorPool(size_t high_water = TENSOR_POOL_HIGH_WATER, size_t max_bytes = TENSOR_POOL_MAX_BYTES);
+
+    virtual ~TensorPool();
+
+    /**
+     * Returns a tensor with uninitialized data, the pool has to be owned by a shared pointer.
+     */
+    SharedTensor get(echolib::any_container<size_t> dimensions, DataType dtype = UINT8);
+
+    void set_high_water(size_t buffers);
+
+    void set_max_bytes(size_t bytes);
+
+    /**
+     * Returns the number of bytes held by free buffers.
+     */
+    size_t get_retained() const;
+
+    /**
+     * Frees all buffers that are not in use.
+     */
+    void clear();
+
+    /**
+     * The default pool is used for tensors that are read from messages, setting it to NULL disables recycling.
+     */
+    static SharedTensorPool get_default();
+
+    static void set_default(SharedTensorPool pool);
+
+private:
+
+    typedef pair<vector<size_t>, DataType> PoolKey;
+
+    typedef struct PoolEntry {
+        vector<uchar*> free;
+        size_t size;
+        std::list<PoolKey>::iterator usage;
+    } PoolEntry;
+
+    void release(const PoolKey& key, uchar* data, size_t size);
+
+    void trim();
+
+    // Frees one buffer of the least recently used shape
+    void evict();
+
+    std::map<PoolKey, PoolEntry> buffers;
+
+    // Shapes with free buffers, the most recently used first
+    std::list<PoolKey> usage;
+
+    size_t high_water;
+    size_t max_bytes;
+    size_t retained;
+
+    mutable std::mutex mutex;
+
+};
+
 class ArrayBuffer : public Buffer {
 public:
     ArrayBuffer(SharedArray array, function<void()> complete = NULL);
@@ -136,6 +307,8 @@ public:
 
     virtual size_t copy_data(size_t position, uchar* buffer, size_t length) const;
 
+    virtual const uchar* get_span(size_t position, size_t& length) const;
+
 private:
 
     const SharedArray array;
@@ -147,6 +320,16 @@ template<> inline void read(MessageReader& reader, SharedArray& dst) {
 
     int size = reader.read<size_t>(); 
 
+    if (reader.is_aliasing() && size > 0) {
+        // Point into the received message and keep it alive instead of copying
+        const uchar* span = reader.read_span(size);
+        if (span) {
+            SharedMessage message = reader.get_message();
+            dst = make_shared<Array>(size, (uchar*) span, [message]() {});
+            return;
+        }
+    }
+
     dst = make_shared<Array>(size);
 
     reader.copy_data(dst->get_data(), size);
@@ -161,6 +344,12 @@ template<> inline void write(MessageWriter& writer, const SharedArray& src) {
 
 }
 
+template<> inline size_t message_length(const SharedArray& src) {
+
+    return sizeof(size_t) + src->get_size();
+
+}
+
 template<> inline void read(MessageReader& reader, SharedTensor& dst) {
 
     uint8_t ndim = reader.read<size_t>(); 
@@ -171,25 +360,90 @@ template<> inline void read(MessageReader& reader, SharedTensor& dst) {
         dimensions.push_back(reader.read<size_t>());
     }
 
-    DataType type = (DataType) reader.read<uint8_t>(); 
+    uint8_t type_flags = reader.read<uint8_t>();
+
+    DataType type = (DataType) (type_flags & ~TENSOR_PADDING_FLAG);
+
+    if (type_flags & TENSOR_PADDING_FLAG) {
+        reader.skip(reader.read<uint8_t>());
+    }
+
+    if (reader.is_aliasing() && ndim > 0) {
+
+        size_t count = 1;
+        for (auto d : dimensions) count *= d;
+        size_t size = Tensor::get_storage_size(type, count);
+
+        // Only contiguous and aligned data can be aliased, fragmented data is copied below
+        const uchar* span = (size > 0) ? reader.read_span(size, max((size_t) 1, Tensor::get_type_bytes(type))) : NULL;
+        if (span) {
+            SharedMessage message = reader.get_message();
+            dst = make_shared<Tensor>(dimensions, type, (uchar*) span, [message]() {});
+            return;
+        }
+    }
+
+    SharedTensorPool pool = TensorPool::get_default();
 
-    dst = make_shared<Tensor>(dimensions, type);
+    dst = pool ? pool->get(dimensions, type) : make_shared<Tensor>(dimensions, type);
 
-    reader.copy_data(dst->get_data(), dst->get_size());
+    // A zero length would copy the rest of the message
+    if (dst->get_size() > 0)
+        reader.copy_data(dst->get_data(), dst->get_size());
 
 }
 
-template<> inline void write(MessageWriter& writer, const SharedTensor& src) {
-    
+/**
+ * Writes the dimensions and the type of a tensor. The position of the header from the start of the message is used
+ * to pad the data of large tensors to TENSOR_DATA_ALIGNMENT so that it can be aliased by SIMD code on the receiving side.
+ */
+inline void write_tensor_header(MessageWriter& writer, const SharedTensor& src, size_t position) {
+
     writer.write<size_t>((size_t) src->ndims());
 
     for (size_t i = 0; i < src->ndims(); i++) {
         writer.write<size_t>(src->shape(i));
     }
 
-    writer.write<uint8_t>((uint8_t) src->get_type());
+    size_t alignment = (src->get_size() >= TENSOR_ALIGNMENT_THRESHOLD) ? TENSOR_DATA_ALIGNMENT :
+        max((size_t) 1, Tensor::get_type_bytes(src->get_type()));
 
-    writer.write_buffer(src->get_data(), src->get_size());
+    size_t start = position + sizeof(size_t) * (1 + src->ndims()) + sizeof(uint8_t);
+
+    if (start % alignment == 0) {
+        writer.write<uint8_t>((uint8_t) src->get_type());
+        return;
+    }
+
+    // Padded tensors have a flag in the type followed by the number of padding bytes
+    uint8_t padding = (alignment - (start + 1) % alignment) % alignment;
+
+    writer.write<uint8_t>((uint8_t) src->get_type() | TENSOR_PADDING_FLAG);
+    writer.write<uint8_t>(padding);
+
+    for (uint8_t i = 0; i < padding; i++) {
+        writer.write<uint8_t>(0);
+    }
+
+}
+
+template<> inline void write(MessageWriter& writer, const SharedTensor& src) {
+
+    write_tensor_header(writer, src, writer.get_length());
+
+    if (src->is_contiguous()) {
+        writer.write_buffer(src->get_data(), src->get_size());
+    } else {
+        // Gather strided data directly into the message
+        writer.write_buffer(ArrayBuffer(src));
+    }
+
+}
+
+template<> inline size_t message_length(const SharedTensor& src) {
+
+    // Upper bound, the padding depends on the position in the message
+    return sizeof(size_t) * (1 + src->ndims()) + sizeof(uint8_t) * 2 + TENSOR_DATA_ALIGNMENT + src->get_size();
 
 }
 
@@ -230,17 +484,29 @@ inline shared_ptr<SharedTensor> Message::unpack(SharedMessage message) {
     return out;
 }
 
-template<>
-inline shared_ptr<Message> Message::pack(const SharedTensor &data) {
+/**
+ * Packs a tensor that will be placed at the given position in a message, the data is not copied.
+ */
+inline shared_ptr<Message> pack_tensor(const SharedTensor &data, size_t position = 0) {
+
+    MessageWriter writer(sizeof(size_t) * (1 + data->ndims()) + sizeof(uint8_t) * 2 + TENSOR_DATA_ALIGNMENT);
+
+    write_tensor_header(writer, data, position);
 
     return make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{
-        ListBuffer<size_t>::wrap(data->dims()),
-        PrimitiveBuffer<uchar>::wrap(data->get_type()),
+        make_shared<BufferedMessage>(writer),
         make_shared<ArrayBuffer>(data)
     });
 
 }
 
+template<>
+inline shared_ptr<Message> Message::pack(const SharedTensor &data) {
+
+    return pack_tensor(data);
+
+}
+
 }
 
 #endif
\ No newline at end of file
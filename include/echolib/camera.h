@@ -1,3 +1,6 @@
+#ifndef __ECHOLIB_CAMERA_H
+#define __ECHOLIB_CAMERA_H
+
 #include <echolib/datatypes.h>
 #include <echolib/array.h>
 
@@ -16,16 +19,54 @@ typedef struct CameraExtrinsics {
     SharedTensor translation;
 } CameraExtrinsics;
 
+// Layout of 8-bit frame images: RGB and BGR {h, w, 3}, GRAY {h, w}, YUYV {h, w, 2}, NV12 {h * 3 / 2, w} and Bayer {h, w}
+enum PixelFormat { PIXEL_RGB = 0, PIXEL_BGR = 1, PIXEL_GRAY = 2, PIXEL_YUYV = 3, PIXEL_NV12 = 4,
+    PIXEL_BAYER_BGGR = 5, PIXEL_BAYER_RGGB = 6, PIXEL_BAYER_GBRG = 7, PIXEL_BAYER_GRBG = 8 };
+
 typedef struct Frame {
     Header header;
     SharedTensor image;
+    PixelFormat format = PIXEL_RGB;
 } Frame;
 
+/**
+ * Converts an image to RGB, BGR or GRAY, returns the image itself if it already has the target format. Frames are
+ * published in their native format, so consumers convert only when they need a different layout.
+ */
+SharedTensor convert_image(const SharedTensor& image, PixelFormat source, PixelFormat target, SharedTensorPool pool = SharedTensorPool());
+
+// Encodings of compressed frames, JPEG is lossy and PNG lossless
+enum FrameEncoding { ENCODING_JPEG = 0, ENCODING_PNG = 1 };
+
+/**
+ * A frame that is encoded once by the publisher and sent as is to every subscriber. The received data points into
+ * the message, the image is only decoded when decompress_frame is called. Decoded images are BGR or GRAY.
+ */
+typedef struct CompressedFrame {
+    Header header;
+    FrameEncoding encoding = ENCODING_JPEG;
+    PixelFormat format = PIXEL_BGR;
+    int width = 0;
+    int height = 0;
+    SharedBuffer data;
+} CompressedFrame;
+
+/**
+ * Encodes the image of a frame, the quality is 0-100 for JPEG and the compression level 0-9 for PNG, a negative
+ * value selects the default. Requires OpenCV.
+ */
+CompressedFrame compress_frame(const Frame& frame, FrameEncoding encoding = ENCODING_JPEG, int quality = -1);
+
+/**
+ * Decodes the image of a compressed frame into a tensor from the pool. Requires OpenCV.
+ */
+SharedTensor decompress_frame(const CompressedFrame& frame, SharedTensorPool pool = TensorPool::get_default());
+
 template <> inline string get_type_identifier<CameraExtrinsics>() { return string("camera extrinsics"); }
 
 template<> inline shared_ptr<Message> echolib::Message::pack<CameraExtrinsics>(const CameraExtrinsics &data)
 {
-    MessageWriter writer;
+    MessageWriter writer(message_length(data.header) + message_length(data.rotation) + message_length(data.translation));
 
     write(writer, data.header);
     write(writer, data.rotation);
@@ -49,7 +90,7 @@ template <> inline string get_type_identifier<CameraIntrinsics>() { return strin
 
 template<> inline shared_ptr<Message> echolib::Message::pack<CameraIntrinsics>(const CameraIntrinsics &data)
 {
-    MessageWriter writer;
+    MessageWriter writer(sizeof(int) * 2 + message_length(data.intrinsics) + message_length(data.distortion));
 
     writer.write<int>(data.width);
     writer.write<int>(data.height);
@@ -76,9 +117,12 @@ template <> inline string get_type_identifier<Frame>() { return string("camera f
 
 template<> inline shared_ptr<Message> echolib::Message::pack<Frame>(const Frame &data) {
 
+    SharedMessage header = pack<Header>(data.header);
+
     return make_shared<MultiBufferMessage>(initializer_list<SharedBuffer>{
-        pack<Header>(data.header),
-        pack<SharedTensor>(data.image)
+        header,
+        pack_tensor(data.image, header->get_length()),
+        PrimitiveBuffer<uchar>::wrap((uchar) data.format)
     });
 
 }
@@ -89,7 +133,56 @@ template<> inline shared_ptr<Frame> echolib::Message::unpack<Frame>(SharedMessag
     shared_ptr<Frame> result(new Frame());
     read(reader, result->header);
     read(reader, result->image);
+    // Frames from older publishers end after the image and are always RGB
+    if (reader.get_position() < reader.get_length())
+        result->format = (PixelFormat) reader.read<uint8_t>();
+    return result;
+}
+
+template <> inline string get_type_identifier<CompressedFrame>() { return string("compressed camera frame"); }
+
+template<> inline shared_ptr<Message> echolib::Message::pack<CompressedFrame>(const CompressedFrame &data) {
+
+    size_t length = data.data ? data.data->get_length() : 0;
+
+    MessageWriter writer(message_length(data.header) + sizeof(uint8_t) * 2 + sizeof(int) * 2 + sizeof(size_t));
+
+    write(writer, data.header);
+    writer.write<uint8_t>((uint8_t) data.encoding);
+    writer.write<uint8_t>((uint8_t) data.format);
+    writer.write<int>(data.width);
+    writer.write<int>(data.height);
+    writer.write<size_t>(length);
+
+    // The encoded data is shared with the frame and not copied
+    SharedMessage prefix = make_shared<BufferedMessage>(writer);
+    if (!length) return prefix;
+
+    return make_shared<MultiBufferMessage>(initializer_list<SharedBuffer>{prefix, data.data});
+
+}
+
+template<> inline shared_ptr<CompressedFrame> echolib::Message::unpack<CompressedFrame>(SharedMessage message) {
+    MessageReader reader(message);
+
+    shared_ptr<CompressedFrame> result(new CompressedFrame());
+    read(reader, result->header);
+    result->encoding = (FrameEncoding) reader.read<uint8_t>();
+    result->format = (PixelFormat) reader.read<uint8_t>();
+    result->width = reader.read<int>();
+    result->height = reader.read<int>();
+
+    size_t length = reader.read<size_t>();
+    if (length > reader.get_length() - reader.get_position())
+        throw EndOfBufferException();
+
+    // Encoded data is never modified, so it always refers to the message instead of being copied
+    result->data = make_shared<OffsetBufferMessage>(message, reader.get_position(), length);
+    reader.skip(length);
+
     return result;
 }
 
-}
\ No newline at end of file
+}
+
+#endif
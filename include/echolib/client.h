@@ -9,7 +9,9 @@
 #include <functional>
 #include <utility>
 #include <mutex>
+#include <atomic>
 #include <type_traits>
+#include <chrono>
 
 #include "loop.h"
 #include "message.h"
@@ -77,6 +79,8 @@ namespace echolib
     class Subscriber;
     class Publisher;
     class Watcher;
+    class Service;
+    class ServiceClient;
     typedef std::shared_ptr<Subscriber> SharedSubscriber;
     typedef std::shared_ptr<Publisher> SharedPublisher;
     typedef std::shared_ptr<Watcher> SharedWatcher;
@@ -84,6 +88,9 @@ namespace echolib
 
     typedef std::shared_ptr<std::function<void(SharedDictionary)>> WatchCallback;
     typedef std::shared_ptr<std::function<void(SharedMessage)>> DataCallback;
+    typedef std::shared_ptr<std::function<void()>> TickCallback;
+    // Returns milliseconds until the next tick is needed or -1 if there is nothing to wait for
+    typedef std::shared_ptr<std::function<int64_t()>> DeadlineCallback;
 
     template <class F>
     DataCallback create_data_callback(F f)
@@ -97,11 +104,47 @@ namespace echolib
         return WatchCallback(new std::function<void(SharedDictionary)>(f));
     }
 
+    template <class F>
+    TickCallback create_tick_callback(F f)
+    {
+        return TickCallback(new std::function<void()>(f));
+    }
+
+    template <class F>
+    DeadlineCallback create_deadline_callback(F f)
+    {
+        return DeadlineCallback(new std::function<int64_t()>(f));
+    }
+
+    /**
+     * Delivery limits that a subscriber can request from the router. The router applies them
+     * per subscriber so that messages that are not needed are never queued for it.
+     */
+    typedef struct SubscriptionOptions
+    {
+        double rate = 0;    // Maximum delivery rate in Hz, zero means no limit
+        int decimation = 1; // Deliver only every n-th message
+        string region;      // Part of a tensor or camera frame, e.g. "100:200,::2" (start:end:step per dimension)
+
+        bool is_limited() const { return rate > 0 || decimation > 1 || !region.empty(); }
+
+        bool operator!=(const SubscriptionOptions &other) const
+        {
+            return rate != other.rate || decimation != other.decimation || region != other.region;
+        }
+    } SubscriptionOptions;
+
+#define LOOKUP_PUBLISHER 1
+#define LOOKUP_LATCHED 2
+#define LOOKUP_SERVICE 4
+
     class Client : public IOBase
     {
         friend Subscriber;
         friend Publisher;
         friend Watcher;
+        friend Service;
+        friend ServiceClient;
 
     public:
         Client(const string &name = "", const string &address = "");
@@ -111,6 +154,8 @@ namespace echolib
 
         virtual bool handle_output();
 
+        virtual int64_t get_timeout();
+
         bool is_connected();
 
         virtual void disconnect();
@@ -119,13 +164,35 @@ namespace echolib
 
         virtual int get_file_descriptor();
 
+        /**
+         * Returns the codec that compresses outgoing messages, "none" for local connections and older routers.
+         */
+        string get_compression() const;
+
+        /**
+         * Returns the counters for compressed outgoing or decompressed incoming messages.
+         */
+        CompressionStatistics get_compression_statistics(bool incoming = false) const;
+
     protected:
         bool unsubscribe(int channel, const DataCallback &callback);
-        bool subscribe(int channel, const DataCallback &callback);
+        bool subscribe(int channel, const DataCallback &callback, const SubscriptionOptions &options = SubscriptionOptions());
         bool watch(int channel, const WatchCallback &callback);
         bool unwatch(int channel, const WatchCallback &callback);
+        bool publish(int channel, const WatchCallback &callback);
+        bool unpublish(int channel, const WatchCallback &callback);
+        bool attach(int channel, const DataCallback &callback);
+        bool detach(int channel, const DataCallback &callback);
+        bool add_tick(const TickCallback &callback);
+        bool remove_tick(const TickCallback &callback);
+        bool add_deadline(const DeadlineCallback &callback);
+        bool remove_deadline(const DeadlineCallback &callback);
         void send(int channel, SharedMessage message, MessageCallback callback = NULL, int priority = 0);
-        void lookup_channel(const string &alias, const string &type, function<void(SharedDictionary)> callback, bool create = true);
+        void lookup_channel(const string &alias, const string &type, function<void(SharedDictionary)> callback, bool create = true, int flags = 0);
+        void lookup_and_subscribe(const string &alias, const string &type, const DataCallback &callback, const SubscriptionOptions &options,
+                                  function<void(SharedDictionary)> lookup_callback);
+        void create_service(const string &alias, const string &type, function<void(SharedDictionary)> callback);
+        void remove_service(int channel);
 
     private:
         static const int TYPE_LOCAL;
@@ -135,6 +202,14 @@ namespace echolib
 
         void send_command(SharedDictionary command, function<bool(SharedDictionary, SharedDictionary)> callback = NULL);
 
+        void queue_command(SharedDictionary command, function<bool(SharedDictionary, SharedDictionary)> callback = NULL);
+
+        void flush_commands();
+
+        void flush_unpublishing();
+
+        void handle_response(SharedDictionary response);
+
         bool handle_subscribe_response(SharedDictionary sent, SharedDictionary received);
         void handle_message(int channel, SharedMessage &message);
 
@@ -145,10 +220,25 @@ namespace echolib
 
         int next_request_key;
 
+        // Set once the router confirms that it accepts batches of commands, older routers ignore them
+        bool batching;
+
         map<int, pair<SharedDictionary, function<bool(SharedDictionary, SharedDictionary)>>> requests;
 
+        vector<SharedDictionary> queued_commands;
+
         map<int, set<DataCallback>> subscriptions;
+        map<int, SubscriptionOptions> subscription_options;
         map<int, set<WatchCallback>> watches;
+        map<int, set<WatchCallback>> publications;
+
+        // Publisher lookups that were not answered yet, a channel is unpublished only once they are, otherwise the
+        // router could handle a lookup for the channel before the unpublish command and forget the new publisher
+        int publishing;
+        set<int> unpublishing;
+        map<int, set<DataCallback>> endpoints;
+        set<TickCallback> ticks;
+        set<DeadlineCallback> deadlines;
 
         map<string, string> mappings;
     };
@@ -160,7 +250,8 @@ namespace echolib
         friend Client;
 
     public:
-        Subscriber(SharedClient client, const string &alias, const string &type = string(), DataCallback callback = NULL, int pending_capacity = 10);
+        Subscriber(SharedClient client, const string &alias, const string &type = string(), DataCallback callback = NULL, int pending_capacity = 10,
+                   const SubscriptionOptions &options = SubscriptionOptions());
 
         virtual ~Subscriber();
 
@@ -187,10 +278,12 @@ namespace echolib
         SharedClient client;
         int id = -1;
 
-        class ChunkList : public vector<SharedMessage>
+        // Chunks are copied into one aligned buffer as they arrive, so that the reassembled message is contiguous
+        // and large tensors in it can be aliased like the ones in single messages
+        class ChunkList
         {
         public:
-            ChunkList(int length, int chunk_size);
+            ChunkList(int64_t length, int chunk_size);
 
             virtual ~ChunkList();
 
@@ -198,14 +291,19 @@ namespace echolib
 
             bool is_complete() const;
 
-            int chunks() const;
+            SharedMessage get_message() const;
 
         private:
+            shared_ptr<BufferedMessage> message;
             int chunk_size;
+            int chunks;
+            int received;
         };
 
         int pending_capacity;
 
+        SubscriptionOptions options;
+
         map<int64_t, shared_ptr<ChunkList>> pending;
     };
 
@@ -243,7 +341,7 @@ namespace echolib
         friend Client;
 
     public:
-        Publisher(SharedClient client, const string &alias, const string &type = string(), int queue = -1, size_t chunk_size = DEFAULT_CHUNK_SIZE);
+        Publisher(SharedClient client, const string &alias, const string &type = string(), int queue = -1, size_t chunk_size = DEFAULT_CHUNK_SIZE, bool latched = false);
 
         virtual ~Publisher();
 
@@ -251,16 +349,34 @@ namespace echolib
 
         bool send_message(MessageWriter &writer);
 
+        /**
+         * Sends a prepared message, the message is referenced until it is written to the socket so its buffers
+         * must not be modified in the meantime.
+         */
+        bool send_message(SharedMessage message);
+
+        /**
+         * Returns false only when the router reported that nobody is subscribed to the channel.
+         */
+        bool has_subscribers() const;
+
+        /**
+         * Latched channels keep the last message in the router and deliver it to every new subscriber.
+         */
+        bool is_latched() const;
+
     protected:
         virtual void on_ready();
 
+        virtual void on_subscribers(int subscribers);
+
         int get_channel_id();
 
         template <typename T>
         bool send_message(const T &data)
         {
 
-            if (get_channel_id() <= 0)
+            if (get_channel_id() <= 0 || !(latched || has_subscribers()))
                 return false;
 
             return send_message_internal(Message::pack<T>(data), get_channel_id());
@@ -273,10 +389,19 @@ namespace echolib
 
         void send_callback(const SharedMessage message, int state);
 
+        void subscription_callback(SharedDictionary event);
+
         SharedClient client;
         int id = -1;
         int queue;
 
+        // Updated on the loop thread, read by producers that may run elsewhere
+        std::atomic<int> subscribers{-1};
+
+        bool latched;
+
+        WatchCallback subscription_handler;
+
         int pending = 0;
 
         class ProxyBuffer : public Buffer
@@ -290,6 +415,8 @@ namespace echolib
 
             virtual size_t copy_data(size_t position, uchar *buffer, size_t length) const;
 
+            virtual const uchar *get_span(size_t position, size_t &length) const;
+
         private:
             SharedMessage parent;
             size_t start;
@@ -301,6 +428,104 @@ namespace echolib
         function<int64_t()> identifier_generator;
     };
 
+    typedef std::function<SharedMessage(SharedMessage)> ServiceHandler;
+    typedef std::function<void(int, SharedMessage)> ResponseCallback;
+
+    /**
+     * Provides a service, the router forwards requests only to this endpoint and routes responses back to the caller.
+     */
+    class Service
+    {
+    public:
+        Service(SharedClient client, const string &alias, const string &type = string(), ServiceHandler handler = NULL);
+
+        virtual ~Service();
+
+        virtual void on_error(const std::exception &error);
+
+    protected:
+        virtual void on_ready();
+
+        /**
+         * Handles a request and returns the response, an exception is reported to the caller as ECHO_SERVICE_ERROR.
+         */
+        virtual SharedMessage on_request(SharedMessage request);
+
+    private:
+        void lookup_callback(SharedDictionary lookup);
+
+        void request_callback(SharedMessage message);
+
+        SharedClient client;
+        int id = -1;
+
+        ServiceHandler handler;
+
+        DataCallback internal_callback;
+    };
+
+    /**
+     * Calls a service, any number of requests can be in flight at once and each one is completed exactly once,
+     * either with the response or with an error status. The event loop does not block past the earliest deadline, so
+     * timeouts are reported on time even when it waits without a timeout. Requests are not chunked, so they have to
+     * fit into a single message.
+     */
+    class ServiceClient
+    {
+    public:
+        ServiceClient(SharedClient client, const string &alias, const string &type = string(), int64_t timeout = 1000);
+
+        virtual ~ServiceClient();
+
+        virtual void on_error(const std::exception &error);
+
+        bool call(SharedMessage request, ResponseCallback callback, int64_t timeout = -1);
+
+        size_t get_pending() const;
+
+    protected:
+        virtual void on_ready();
+
+    private:
+        typedef struct PendingRequest
+        {
+            SharedMessage request; // Kept only until the lookup is done
+            ResponseCallback callback;
+            std::chrono::steady_clock::time_point deadline;
+        } PendingRequest;
+
+        void lookup_callback(SharedDictionary lookup);
+
+        void response_callback(SharedMessage message);
+
+        void dispatch(int64_t identifier, SharedMessage request);
+
+        void complete(int64_t identifier, int status, SharedMessage response);
+
+        void tick();
+
+        int64_t get_deadline();
+
+        SharedClient client;
+        int id = -1;
+        bool failed = false;
+
+        int64_t timeout;
+
+        DataCallback internal_callback;
+        TickCallback tick_callback;
+        DeadlineCallback deadline_callback;
+
+        // Requests are made from any thread, responses and timeouts are handled in the loop, callbacks are called
+        // outside of the lock
+        mutable std::recursive_mutex mutex;
+
+        map<int64_t, PendingRequest> pending;
+
+        // Send callbacks can outlive the object, they only touch it while this is set
+        shared_ptr<bool> alive;
+    };
+
     class SubscriptionWatcher : public Watcher
     {
     public:
@@ -15,7 +15,8 @@ template<typename T> string get_type_identifier();
 template <typename T>
 class TypedSubscriber : Subscriber {
   public:
-    TypedSubscriber(SharedClient client, const string &alias, function<void(shared_ptr<T>)> callback) : Subscriber(client, alias, get_type_identifier<T>()), callback(callback) {
+    TypedSubscriber(SharedClient client, const string &alias, function<void(shared_ptr<T>)> callback, const SubscriptionOptions &options = SubscriptionOptions()) :
+        Subscriber(client, alias, get_type_identifier<T>(), NULL, 10, options), callback(callback) {
 
     }
 
@@ -45,7 +46,7 @@ class TypedSubscriber : Subscriber {
 template <typename T>
 class TypedPublisher : Publisher {
   public:
-    TypedPublisher(SharedClient client, const string &alias, int queue = -1) : Publisher(client, alias, get_type_identifier<T>(), queue) {
+    TypedPublisher(SharedClient client, const string &alias, int queue = -1, bool latched = false) : Publisher(client, alias, get_type_identifier<T>(), queue, DEFAULT_CHUNK_SIZE, latched) {
 
     }
 
@@ -53,12 +54,91 @@ class TypedPublisher : Publisher {
 
     }
 
+    using Publisher::has_subscribers;
+    using Publisher::is_latched;
+
     bool send(const T &data) {
 
         return Publisher::send_message<T>(data);
 
     }
 
+    /**
+     * Sends a message that was already packed from a value of type T, the same message can be sent repeatedly.
+     */
+    bool send(SharedMessage message) {
+
+        return Publisher::send_message(message);
+
+    }
+
+};
+
+template <typename Request, typename Response>
+string get_service_type_identifier() {
+    return get_type_identifier<Request>() + " -> " + get_type_identifier<Response>();
+}
+
+template <typename Request, typename Response>
+class TypedService : Service {
+  public:
+    TypedService(SharedClient client, const string &alias, function<Response(shared_ptr<Request>)> handler) :
+        Service(client, alias, get_service_type_identifier<Request, Response>()), handler(handler) {
+
+    }
+
+    virtual ~TypedService() {
+
+    }
+
+  protected:
+    virtual SharedMessage on_request(SharedMessage message) {
+
+        shared_ptr<Request> request = Message::unpack<Request>(message);
+
+        return Message::pack<Response>(handler(request));
+
+    }
+
+  private:
+    function<Response(shared_ptr<Request>)> handler;
+
+};
+
+template <typename Request, typename Response>
+class TypedServiceClient : ServiceClient {
+  public:
+    TypedServiceClient(SharedClient client, const string &alias, int64_t timeout = 1000) :
+        ServiceClient(client, alias, get_service_type_identifier<Request, Response>(), timeout) {
+
+    }
+
+    virtual ~TypedServiceClient() {
+
+    }
+
+    using ServiceClient::get_pending;
+
+    bool call(const Request &request, function<void(int, shared_ptr<Response>)> callback, int64_t timeout = -1) {
+
+        return ServiceClient::call(Message::pack<Request>(request), [callback](int status, SharedMessage message) {
+
+            shared_ptr<Response> response;
+
+            if (status == ECHO_SERVICE_OK) {
+                try {
+                    response = Message::unpack<Response>(message);
+                } catch (echolib::ParseException &e) {
+                    status = ECHO_SERVICE_ERROR;
+                }
+            }
+
+            callback(status, response);
+
+        }, timeout);
+
+    }
+
 };
 
 template<typename T> using SharedTypedSubscriber = shared_ptr<TypedSubscriber<T> >;
@@ -109,6 +189,13 @@ inline void write(MessageWriter& writer, const Header& header) {
 
 }
 
+template <>
+inline size_t message_length(const Header& header) {
+
+    return message_length(header.source) + sizeof(int64_t);
+
+}
+
 
 
 template <> inline string get_type_identifier<Dictionary>() { return string("dictionary"); }
@@ -127,7 +214,6 @@ inline shared_ptr<Dictionary> Message::unpack(SharedMessage message) {
 
 template<>
 inline shared_ptr<Message> Message::pack(const Dictionary &data) {
-    std::map<std::string, std::string>::const_iterator iter;
 
     ssize_t length = message_length(data);
 
@@ -153,7 +239,7 @@ inline shared_ptr<Header> Message::unpack(SharedMessage message) {
 template<>
 inline shared_ptr<Message> Message::pack(const Header &data) {
 
-    MessageWriter writer(sizeof(size_t) + data.source.size() + sizeof(time_point));
+    MessageWriter writer(message_length(data));
 
     write(writer, data.source);
     write(writer, data.timestamp);
@@ -161,6 +247,31 @@ inline shared_ptr<Message> Message::pack(const Header &data) {
     return make_shared<BufferedMessage>(writer);
 }
 
+/**
+ * Returns the part of a packed message that follows its header, without copying it.
+ */
+inline SharedMessage strip_header(SharedMessage message) {
+
+    MessageReader reader(message);
+
+    Header header;
+    read(reader, header);
+
+    return make_shared<OffsetBufferMessage>(message, reader.get_position());
+}
+
+/**
+ * Prepends a newly packed header to a message body returned by strip_header, the body is shared and not copied.
+ * Padding in the body stays aligned as long as the header has the same length (the same source).
+ */
+inline SharedMessage pack_with_header(const Header &header, SharedMessage body) {
+
+    return make_shared<MultiBufferMessage>(initializer_list<SharedBuffer>{
+        Message::pack<Header>(header),
+        body
+    });
+}
+
 
 
 }
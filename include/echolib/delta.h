@@ -0,0 +1,81 @@
+#ifndef __ECHOLIB_DELTA_H
+#define __ECHOLIB_DELTA_H
+
+#include <echolib/client.h>
+#include <echolib/datatypes.h>
+#include <echolib/array.h>
+
+namespace echolib {
+
+// Granularity of changes in delta messages, in bytes
+#define DELTA_BLOCK_SIZE 64
+// Number of delta messages between two keyframes
+#define DELTA_KEYFRAME_INTERVAL 100
+
+#define DELTA_TENSOR_TYPE "delta tensor"
+
+#define DELTA_KEYFRAME 0
+#define DELTA_UPDATE 1
+
+/**
+ * Publishes tensors that change little between messages (depth maps, occupancy grids, frames from a static camera)
+ * as periodic keyframes and deltas with the blocks that changed since the previous message. A keyframe is sent
+ * whenever a subscriber joins, when the shape changes, when a message could not be queued and when a delta would
+ * not be much smaller than the tensor. Keyframes share the tensor data, so it must not be modified until it is sent.
+ */
+class DeltaTensorPublisher : Publisher {
+  public:
+    DeltaTensorPublisher(SharedClient client, const string &alias, size_t keyframe_interval = DELTA_KEYFRAME_INTERVAL, int queue = -1);
+
+    virtual ~DeltaTensorPublisher();
+
+    bool send(const SharedTensor &tensor);
+
+    /**
+     * Sends the next tensor as a keyframe.
+     */
+    void force_keyframe();
+
+    using Publisher::has_subscribers;
+
+  protected:
+    virtual void on_subscribers(int subscribers);
+
+  private:
+    size_t keyframe_interval;
+    size_t updates;
+    bool keyframe;
+    int subscribers;
+
+    uint64_t sequence;
+
+    // Copy of the last sent tensor, deltas are computed against it
+    SharedTensor reference;
+};
+
+/**
+ * Reconstructs tensors from a delta channel into a persistent buffer. Deltas are applied only on top of the
+ * message they were computed against, after a lost message the subscriber waits for the next keyframe. The tensor
+ * passed to the callback is updated in place by later messages, it has to be copied to keep it. Rate limits and
+ * decimation drop messages, so they should not be used with delta channels.
+ */
+class DeltaTensorSubscriber : Subscriber {
+  public:
+    DeltaTensorSubscriber(SharedClient client, const string &alias, function<void(SharedTensor)> callback);
+
+    virtual ~DeltaTensorSubscriber();
+
+    virtual void on_message(SharedMessage message);
+
+  private:
+    function<void(SharedTensor)> callback;
+
+    SharedTensor state;
+    bool valid;
+
+    uint64_t sequence;
+};
+
+}
+
+#endif
@@ -8,11 +8,13 @@
 
 namespace echolib {
 
-template<typename T> class StaticPublisher: public TypedPublisher<T>, public Watcher, public std::enable_shared_from_this<StaticPublisher<T> > {
+/**
+ * Publishes a constant value on a latched channel. The router retains the message and delivers it
+ * to every new subscriber, so the value is packed and sent only once.
+ */
+template<typename T> class StaticPublisher: public TypedPublisher<T>, public std::enable_shared_from_this<StaticPublisher<T> > {
 public:
-    StaticPublisher(SharedClient client, const string &alias, T& value) : TypedPublisher<T>(client, alias), Watcher(client, alias), value(value) {
-
-        subscribers = 0;
+    StaticPublisher(SharedClient client, const string &alias, T& value) : TypedPublisher<T>(client, alias, -1, true), message(Message::pack<T>(value)) {
 
     }
 
@@ -20,31 +22,26 @@ public:
 
     virtual ~StaticPublisher() {}
 
-    virtual void on_event(SharedDictionary message) {
-        string type = message->get<string>("type", "");
+protected:
 
-        if (type == "subscribe" || type == "unsubscribe" || type == "summary") {
-            int s = message->get<int>("subscribers", 0);
-            if (s > subscribers) {
-                send(value);
-            }
-            subscribers = s;
-        }
+    virtual void on_ready() {
+        send(message);
     }
 
 private:
 
-    int subscribers;
-
-    T value;
+    // Packed once, the same message is sent again after reconnecting
+    SharedMessage message;
 
 };
 
-template<typename T> class ObjectPublisher: public TypedPublisher<T>, public Watcher, public std::enable_shared_from_this<ObjectPublisher<T> > {
+/**
+ * Publishes the latest state of an object on a latched channel, new subscribers receive the last
+ * value from the router.
+ */
+template<typename T> class ObjectPublisher: public TypedPublisher<T>, public std::enable_shared_from_this<ObjectPublisher<T> > {
 public:
-    ObjectPublisher(SharedClient client, const string &alias, T& value) : TypedPublisher<T>(client, alias), Watcher(client, alias), value(value) {
-
-        subscribers = 0;
+    ObjectPublisher(SharedClient client, const string &alias, T& value) : TypedPublisher<T>(client, alias, -1, true), value(value) {
 
     }
 
@@ -52,31 +49,26 @@ public:
 
     virtual ~ObjectPublisher() {}
 
-    virtual void on_event(SharedDictionary message) {
-        string type = message->get<string>("type", "");
-
-        if (type == "subscribe" || type == "unsubscribe" || type == "summary") {
-            int s = message->get<int>("subscribers", 0);
-            if (s > subscribers) {
-                send(value);
-            }
-            subscribers = s;
-        }
-    }
-
     void update(T& new_value) {
 
         value = new_value;
+        message = Message::pack<T>(value);
 
-        send(value);
+        send(message);
 
     }
 
-private:
+protected:
 
-    int subscribers;
+    virtual void on_ready() {
+        if (!message) message = Message::pack<T>(value);
+        send(message);
+    }
+
+private:
 
     T value;
+    SharedMessage message;
 
 };
 
@@ -54,6 +54,13 @@ public:
 	 */
 	virtual bool handle_output() = 0;
 
+	/**
+	 * Returns the number of milliseconds until handle_output has to be called again or -1 if it only needs to be
+	 * called when there is something to write. The loop does not block for longer than that.
+	 *
+	 */
+	virtual int64_t get_timeout() { return -1; };
+
 	virtual void disconnect() = 0;
 
     bool observe(SharedIOBaseObserver observer);
@@ -104,6 +111,10 @@ public:
 
 private:
 
+	bool flush_output();
+
+	int64_t get_timeout();
+
 	class IOLoopWriteObserver: public IOBaseObserver {
 	public:
 		IOLoopWriteObserver(IOLoop* context): context(context), flag(false) {};
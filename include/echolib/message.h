@@ -14,6 +14,7 @@
 #include <functional>
 #include <iostream>
 #include <type_traits>
+#include <cstdint>
 
 using namespace std;
 
@@ -36,11 +37,37 @@ using namespace std;
 #define ECHO_COMMAND_SET_NAME 9
 #define ECHO_COMMAND_GET_NAME 10
 #define ECHO_COMMAND_CREATE_SERVICE 11
+#define ECHO_COMMAND_BATCH 12
+#define ECHO_COMMAND_REMOVE_SERVICE 13
+#define ECHO_COMMAND_SET_COMPRESSION 14
+#define ECHO_COMMAND_UNPUBLISH 15
+#define ECHO_COMMAND_GET_FEATURES 16
+
+#define ECHO_SERVICE_OK 0
+#define ECHO_SERVICE_ERROR 1
+#define ECHO_SERVICE_UNAVAILABLE 2
+#define ECHO_SERVICE_TIMEOUT 3
+#define ECHO_SERVICE_DROPPED 4
+
+// First byte of every message on a service channel, a connection may provide and call the same service
+#define ECHO_SERVICE_REQUEST 1
+#define ECHO_SERVICE_RESPONSE 2
 
 // TODO: move buffer size from a define to a variable that the user can change, since it has an effect on performance
 #define BUFFER_SIZE 1024 * 100
 #define MESSAGE_MAX_SIZE 1024 * 50
 #define MESSAGE_MAX_QUEUE 5000
+// Received data is placed so that the payload after the channel and sequence numbers is aligned to this many bytes
+#define MESSAGE_PAYLOAD_ALIGNMENT 64
+#define MESSAGE_PAYLOAD_OFFSET 8
+
+// Codecs for compressing the messages of a connection, the ones that are available depend on the build
+#define STREAM_CODEC_NONE 0
+#define STREAM_CODEC_LZ4 1
+#define STREAM_CODEC_ZSTD 2
+#define STREAM_CODEC_ZLIB 3
+// Smaller messages are sent as they are
+#define STREAM_COMPRESSION_THRESHOLD 1024
 
 namespace echolib
 {
@@ -113,6 +140,12 @@ namespace echolib
 
         virtual size_t copy_data(size_t position, uchar *buffer, size_t length) const = 0;
 
+        /**
+         * Returns a pointer to the data at the given position if the storage is directly addressable, the length is set
+         * to the number of contiguous bytes available from there. Returns NULL otherwise.
+         */
+        virtual const uchar *get_span(size_t position, size_t &length) const;
+
         virtual void inspect_data(ostream& output) const;
     };
 
@@ -129,6 +162,8 @@ namespace echolib
 
         virtual size_t copy_data(size_t position, uchar *buffer, size_t length) const;
 
+        virtual const uchar *get_span(size_t position, size_t &length) const;
+
         uchar *get_buffer() const;
 
     protected:
@@ -164,6 +199,18 @@ namespace echolib
         template <typename T>
         static shared_ptr<T> unpack(SharedMessage message);
 
+    private:
+        // Compressed form of the message, a message without data did not compress
+        typedef struct CompressedForm
+        {
+            int codec;
+            SharedMessage data;
+        } CompressedForm;
+
+        // Kept by stream writers so that a message written to several connections is compressed only once, it is
+        // accessed atomically since a message may be shared between loops
+        shared_ptr<const CompressedForm> compressed;
+
     };
 
     /**
@@ -204,6 +251,8 @@ namespace echolib
 
         virtual size_t copy_data(size_t position, uchar *buffer, size_t length) const;
 
+        virtual const uchar *get_span(size_t position, size_t &length) const;
+
     private:
         void rebuild();
 
@@ -240,6 +289,15 @@ namespace echolib
             return length;
         }
 
+        virtual const uchar *get_span(size_t position, size_t &length) const
+        {
+            if (position >= sizeof(T))
+                return NULL;
+
+            length = sizeof(T) - position;
+            return &(((const uchar *)&(value))[position]);
+        }
+
         static SharedBuffer wrap(const T value)
         {
             return SharedBuffer(new PrimitiveBuffer<T>(value));
@@ -292,6 +350,16 @@ namespace echolib
             return length + plength;
         }
 
+        virtual const uchar *get_span(size_t position, size_t &length) const
+        {
+            // Only the elements are stored, the size prefix is generated
+            if (position < sizeof(size_t) || position >= get_length())
+                return NULL;
+
+            length = get_length() - position;
+            return &(((const uchar *)&(value[0]))[position - sizeof(size_t)]);
+        }
+
         static SharedBuffer wrap(const any_container<T> value) { return SharedBuffer(new ListBuffer<T>(value)); }
 
     private:
@@ -301,7 +369,10 @@ namespace echolib
     class OffsetBufferMessage : public Message
     {
     public:
-        OffsetBufferMessage(const SharedBuffer buffer, size_t offset = 0);
+        /**
+         * Exposes length bytes of a buffer starting at offset, or all remaining bytes by default.
+         */
+        OffsetBufferMessage(const SharedBuffer buffer, size_t offset = 0, size_t length = SIZE_MAX);
 
         virtual ~OffsetBufferMessage();
 
@@ -309,9 +380,12 @@ namespace echolib
 
         virtual size_t copy_data(size_t position, uchar *buffer, size_t length) const;
 
+        virtual const uchar *get_span(size_t position, size_t &length) const;
+
     private:
         SharedBuffer buffer;
         size_t offset;
+        size_t length;
     };
 
     class EndOfBufferException : public std::exception
@@ -328,16 +402,40 @@ namespace echolib
     public:
         MessageReader(SharedMessage message);
 
+        /**
+         * An aliasing reader may return arrays and tensors that point into the message instead of copying the data,
+         * such values keep the message alive and have to be treated as read-only since the message can be shared.
+         * Received messages are contiguous, chunked ones are reassembled into a single aligned buffer, data is copied
+         * only if it is not aligned or if the message is made of several buffers, e.g. one that was packed locally.
+         */
+        MessageReader(SharedMessage message, bool aliasing);
+
         /**
          *
          */
         virtual ~MessageReader();
 
+        bool is_aliasing() const;
+
+        /**
+         * Sets the aliasing mode for readers that do not specify it, e.g. the ones used by Message::unpack.
+         */
+        static void set_default_aliasing(bool aliasing);
+
+        static bool get_default_aliasing();
+
         template <typename T>
         T read()
         {
             static_assert(std::is_arithmetic<T>::value, "Only primitive numeric types supported");
             T value;
+            // Fast path, the value lies in the current contiguous segment
+            if (span && position >= span_start && position + sizeof(T) <= span_end)
+            {
+                memcpy(&value, span + (position - span_start), sizeof(T));
+                position += sizeof(T);
+                return value;
+            }
             copy_data((uchar *)&value, sizeof(T));
             return value;
         }
@@ -345,37 +443,37 @@ namespace echolib
         /**
          * @return next integer
          */
-        int16_t read_short();
+        inline int16_t read_short() { return read<int16_t>(); }
 
         /**
          * @return next integer
          */
-        int32_t read_integer();
+        inline int32_t read_integer() { return read<int32_t>(); }
 
         /**
          * @return next long integer
          */
-        int64_t read_long();
+        inline int64_t read_long() { return read<int64_t>(); }
 
         /**
          * @return next Boolean value
          */
-        bool read_bool();
+        inline bool read_bool() { return read<char>() > 0; }
 
         /**
          * @return next character
          */
-        char read_char();
+        inline char read_char() { return read<char>(); }
 
         /**
          * @return next character
          */
-        double read_double();
+        inline double read_double() { return read<double>(); }
 
         /**
          * @return next character
          */
-        float read_float();
+        inline float read_float() { return read<float>(); }
 
         /**
          * @return next string
@@ -388,12 +486,34 @@ namespace echolib
 
         void copy_data(uchar *buffer, size_t length = 0);
 
+        /**
+         * Returns a pointer to the next length bytes and advances the position if they are stored contiguously
+         * (and the pointer is a multiple of alignment), returns NULL and leaves the position unchanged otherwise.
+         */
+        const uchar *read_span(size_t length, size_t alignment = 1);
+
+        /**
+         * Advances the position by the given number of bytes.
+         */
+        void skip(size_t length);
+
+        SharedMessage get_message() const;
+
         void debug_peek(size_t position, size_t length) const;
 
     private:
+        bool fetch_span();
+
         SharedMessage message;
 
         size_t position;
+
+        bool aliasing;
+
+        // Cached contiguous segment of the message, in message coordinates
+        const uchar *span;
+        size_t span_start;
+        size_t span_end;
     };
 
     template <>
@@ -450,6 +570,13 @@ namespace echolib
         {
 
             static_assert(std::is_arithmetic<T>::value, "Only primitive numeric types supported here");
+            // Fast path, the value fits into the already allocated buffer
+            if (data && data_position + sizeof(T) <= data_length)
+            {
+                memcpy(&(data[data_position]), &value, sizeof(T));
+                data_position += sizeof(T);
+                return;
+            }
             write_buffer((uchar *)&value, sizeof(T));
         }
 
@@ -473,11 +600,20 @@ namespace echolib
 
         virtual int write_buffer(MessageReader &reader, size_t len);
 
+        virtual int write_buffer(const Buffer &buffer);
+
         SharedMessage clone_data();
 
         size_t get_length();
 
+        /**
+         * Makes sure that the buffer can hold at least the given number of bytes without reallocation.
+         */
+        void reserve(size_t capacity);
+
     protected:
+        void grow(size_t required);
+
         bool data_owned;
         uchar *data;
         size_t data_length;
@@ -494,6 +630,8 @@ namespace echolib
         virtual int write_buffer(const uchar *buffer, size_t len);
 
         virtual int write_buffer(MessageReader &reader, size_t len);
+
+        virtual int write_buffer(const Buffer &buffer);
     };
 
     template <>
@@ -532,14 +670,31 @@ namespace echolib
         }
     }
 
+    /**
+     * Returns the number of bytes that writing the value produces. Types with a known layout specialize this to
+     * avoid serializing twice, others are measured with a DummyWriter.
+     */
     template <typename T>
-    size_t message_length(const T data)
+    size_t message_length(const T &data)
     {
 
-        DummyWriter writer;
-        write(writer, data);
+        if constexpr (std::is_arithmetic<T>::value)
+        {
+            return sizeof(T);
+        }
+        else
+        {
+            DummyWriter writer;
+            write(writer, data);
+
+            return writer.get_length();
+        }
+    }
 
-        return writer.get_length();
+    template <>
+    inline size_t message_length(const string &data)
+    {
+        return sizeof(int32_t) + data.size();
     }
 
     typedef std::map<std::string, std::string>::const_iterator DictionaryIterator;
@@ -590,6 +745,28 @@ namespace echolib
         return command;
     }
 
+    typedef struct CompressionStatistics
+    {
+        uint64_t messages = 0;         // Messages that were compressed or decompressed
+        uint64_t raw_bytes = 0;        // Their size before compression
+        uint64_t compressed_bytes = 0; // Their size after compression
+        uint64_t skipped = 0;          // Messages that did not compress well and were sent as they are
+        uint64_t time = 0;             // CPU time spent in the codec, in microseconds
+    } CompressionStatistics;
+
+    /**
+     * Returns the available codecs in the order of preference, the ECHOLIB_COMPRESSION environment variable can
+     * restrict and reorder them with a comma separated list of names or disable compression with "none".
+     */
+    vector<int> get_stream_codecs();
+
+    string get_stream_codec_name(int codec);
+
+    /**
+     * Returns the codec with the given name, STREAM_CODEC_NONE if it is unknown or not available in this build.
+     */
+    int get_stream_codec(const string &name);
+
     class StreamReader
     {
     public:
@@ -602,6 +779,8 @@ namespace echolib
 
         uint64_t get_read_data() const;
 
+        CompressionStatistics get_compression_statistics() const;
+
     private:
         int fd;
 
@@ -609,11 +788,17 @@ namespace echolib
 
         SharedMessage process_buffer();
 
+        SharedMessage decompress();
+
         int error;
 
+        bool compressed;
+        CompressionStatistics statistics;
+
         int state;
         int header_value;
 
+        uchar *allocation;
         uchar *data;
         size_t data_length;
         size_t data_current;
@@ -650,6 +835,15 @@ namespace echolib
 
         unsigned long get_dropped_data() const;
 
+        /**
+         * Compresses messages that are at least threshold bytes long, the peer has to support the codec.
+         */
+        void set_compression(int codec, size_t threshold = STREAM_COMPRESSION_THRESHOLD);
+
+        int get_compression() const;
+
+        CompressionStatistics get_compression_statistics() const;
+
     protected:
         class BoundedQueue;
 
@@ -683,8 +877,18 @@ namespace echolib
 
         bool process_message();
 
+        SharedMessage compress(SharedMessage message);
+
         int error;
 
+        int codec;
+        size_t threshold;
+        CompressionStatistics statistics;
+
+        // The message that is written, the pending message or its compressed form
+        SharedMessage payload;
+        vector<uchar> scratch;
+
         BoundedQueue *outgoing;
 
         MessageContainer pending;
@@ -806,6 +1010,19 @@ namespace echolib
         }
     }
 
+    template <>
+    inline size_t message_length(const Dictionary &data)
+    {
+        size_t length = sizeof(int32_t);
+
+        for (DictionaryIterator iter = data.begin(); iter != data.end(); ++iter)
+        {
+            length += message_length(iter->first) + message_length(iter->second);
+        }
+
+        return length;
+    }
+
     template <>
     inline void write(MessageWriter &writer, const Dictionary &data)
     {
@@ -8,12 +8,37 @@
 #include <map>
 #include <vector>
 #include <set>
+#include <chrono>
 
 using namespace std;
 
 namespace echolib
 {
 
+  class SubscriberFilter
+  {
+
+  public:
+    SubscriberFilter(double rate = 0, int decimation = 1);
+    ~SubscriberFilter();
+
+    // Decides if a message (or a chunk of it) is forwarded, continuation chunks follow the decision for the first
+    // chunk with the same identifier from the same publisher
+    bool admit(SharedClientConnection publisher, int sequence, int64_t identifier = 0);
+
+    void forget(SharedClientConnection publisher);
+
+  private:
+    std::chrono::steady_clock::duration interval;
+    std::chrono::steady_clock::time_point next;
+
+    int decimation;
+    int counter;
+
+    // Identifier of the last chunked message of every publisher and the decision for it
+    map<SharedClientConnection, pair<int64_t, bool>> passing;
+  };
+
   class Channel
   {
 
@@ -23,26 +48,74 @@ namespace echolib
 
     bool publish(SharedClientConnection client, SharedMessage message);
 
-    bool subscribe(SharedClientConnection client);
+    bool subscribe(SharedClientConnection client, bool replay = true);
+
+    void replay(SharedClientConnection client);
+
+    bool set_filter(SharedClientConnection client, double rate, int decimation);
+
+    // Regions are only supported for tensor and camera frame channels, an empty region removes it
+    bool supports_region(const string &region) const;
+    bool set_region(SharedClientConnection client, const string &region);
     bool unsubscribe(SharedClientConnection client);
 
     bool watch(SharedClientConnection client);
     bool unwatch(SharedClientConnection client);
 
+    bool add_publisher(SharedClientConnection client);
+    bool remove_publisher(SharedClientConnection client);
+
     bool is_subscribed(SharedClientConnection client);
     bool is_watching(SharedClientConnection client);
 
+    int get_subscribers() const;
+
+    int get_publishers() const;
+
+    bool is_latched() const;
+    void set_latched(bool latched);
+
+    bool is_service() const;
+    void set_service(bool service);
+
+    SharedClientConnection get_server() const;
+    bool set_server(SharedClientConnection client);
+    bool remove_server(SharedClientConnection client);
+
     string get_type() const;
     bool set_type(const string &type);
     int get_identifier() const;
 
   private:
+    void notify(const string &type);
+
+    void retain(SharedClientConnection client, SharedMessage message, int sequence);
+
+    vector<SharedMessage> assemble(SharedClientConnection client, SharedMessage message, int sequence);
+
+    void send_region(SharedClientConnection client, const vector<SharedMessage> &chunks, map<string, vector<SharedMessage>> &cache);
+
     int identifier;
     string type;
 
     SharedClientConnection owner;
     set<SharedClientConnection> subscribers;
     set<SharedClientConnection> watchers;
+    set<SharedClientConnection> publishers;
+
+    map<SharedClientConnection, SubscriberFilter> filters;
+
+    map<SharedClientConnection, string> regions;
+    // Chunks of incomplete messages per publisher, only collected when there are region subscriptions
+    map<SharedClientConnection, vector<SharedMessage>> assembling;
+
+    bool latched;
+    vector<SharedMessage> retained;
+    // Chunks of the message that is being retained, per publisher
+    map<SharedClientConnection, vector<SharedMessage>> retaining;
+
+    bool service;
+    SharedClientConnection server;
   };
 
   typedef std::shared_ptr<Channel> SharedChannel;
@@ -72,8 +145,14 @@ namespace echolib
 
     SharedDictionary handle_command(SharedClientConnection client, SharedDictionary command);
 
+    SharedDictionary lookup_channel(SharedClientConnection client, SharedDictionary command, int key);
+
+    void route_service(SharedClientConnection client, SharedChannel channel, SharedMessage message);
+
     SharedClientConnection find(int fid);
 
+    SharedClientConnection find_connection(int64_t identifier);
+
     int next_channel_id;
 
     map<string, int> aliases;
@@ -20,6 +20,8 @@ typedef struct ClientStatistics {
     uint64_t data_read;
     uint64_t data_written;
     uint64_t data_dropped;
+    CompressionStatistics compressed;
+    CompressionStatistics decompressed;
 } ClientStatistics;
 
 class ClientConnection;
@@ -47,6 +49,9 @@ public:
 
 	virtual int get_file_descriptor();
 
+    // Unique for the lifetime of the process, unlike file descriptors that are reused after a disconnect
+    int64_t get_identifier() const;
+
     void send(const SharedMessage message);
 
     bool write();
@@ -65,16 +70,26 @@ public:
 
     void set_name(string name);
 
+    // Connected over the network rather than a Unix socket
+    bool is_remote() const;
+
+    void set_compression(int codec);
+
+    int get_compression() const;
+
 private:
 
     int fd;
 
+    int64_t identifier;
+
     string name;
 
     StreamReader reader;
     StreamWriter writer;
 
     bool connected;
+    bool remote;
 
     int process_id;
     int user_id;
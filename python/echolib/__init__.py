@@ -24,6 +24,8 @@ Publisher = _echo.Publisher
 Subscriber = _echo.Subscriber
 MessageReader = _echo.MessageReader
 MessageWriter = _echo.MessageWriter
+readBuffer = _echo.readBuffer
+DataType = _echo.DataType
 
 double = type(bytes_to_native_str(b'double'), (), {})
 char = type(bytes_to_native_str(b'char'), (), {})
@@ -29,19 +29,22 @@ class ArrayPublisher(_echo.Publisher):
 
 class TensorSubscriber(_echo.Subscriber):
 
-    def __init__(self, client, alias, callback):
+    # Received arrays alias the message and are read-only unless copy is requested, chunked messages
+    # are reassembled contiguously so this holds for large tensors too. Data that is not aligned is
+    # copied and stays writable. A region such as "100:200,::2" is cut by the router
+    def __init__(self, client, alias, callback, copy=False, region=""):
         def _read(message):
-            reader = _echo.MessageReader(message)
+            reader = _echo.MessageReader(message, not copy)
             return _echo.readTensor(reader)
 
-        super().__init__(client, alias, "tensor", lambda x: callback(_read(x)))
+        super().__init__(client, alias, "tensor", lambda x: callback(_read(x)), 0, 1, region)
 
 class TensorPublisher(_echo.Publisher):
 
     def __init__(self, client, alias):
         super().__init__(client, alias, "tensor")
 
-    def send(self, obj):
-        writer = _echo.MessageWriter()
-        _echo.writeTensor(writer, obj)
-        super().send(writer)
\ No newline at end of file
+    # The array is sent by reference and must not be modified until it is sent, unless it is
+    # converted to a more compact dtype (e.g. DataType.FLOAT16 or DataType.BIT for masks)
+    def send(self, obj, dtype=None):
+        return self.sendTensor(obj, dtype)
\ No newline at end of file
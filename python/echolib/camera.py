@@ -63,26 +63,89 @@ echolib.registerType(numpy.array, _echo.readTensor, _echo.writeTensor)
 echolib.registerType(CameraIntrinsics, CameraIntrinsics.read, CameraIntrinsics.write)
 echolib.registerType(CameraExtrinsics, CameraExtrinsics.read, CameraExtrinsics.write)
 
+PixelFormat = _echo.PixelFormat
+
 class Frame(object):
 
-    def __init__(self, header = echolib.Header(), image = numpy.array(())):
+    def __init__(self, header = echolib.Header(), image = numpy.array(()), format = PixelFormat.RGB):
         self.header = header
         self.image = image
+        self.format = format
+
+    # Returns the image in RGB, BGR or GRAY layout, converted only if needed
+    def convert(self, format):
+        return _echo.convertImage(self.image, self.format, format)
 
     @staticmethod
     def read(reader):
         obj = Frame()
         obj.header = echolib.readType(echolib.Header, reader)
         obj.image = _echo.readTensor(reader)
+        # Frames from older publishers end after the image and are always RGB
+        if reader.position() < reader.length():
+            obj.format = PixelFormat(ord(reader.readChar()))
         return obj
 
     @staticmethod
     def write(writer, obj):
         echolib.writeType(echolib.Header, writer, obj.header)
         _echo.writeTensor(writer, obj.image)
+        writer.writeChar(chr(int(obj.format)))
 
 echolib.registerType(Frame, Frame.read, Frame.write)
 
+FrameEncoding = _echo.FrameEncoding
+
+class CompressedFrame(object):
+
+    def __init__(self, header = echolib.Header(), data = b'', encoding = FrameEncoding.JPEG, format = PixelFormat.BGR, width = 0, height = 0):
+        self.header = header
+        self.data = data
+        self.encoding = encoding
+        self.format = format
+        self.width = width
+        self.height = height
+        self._image = None
+
+    # Encodes a frame once so that it can be published to any number of subscribers
+    @staticmethod
+    def encode(frame, encoding = FrameEncoding.JPEG, quality = -1):
+        data, format, width, height = _echo.encodeImage(frame.image, frame.format, encoding, quality)
+        return CompressedFrame(frame.header, data, encoding, format, width, height)
+
+    # The image is decoded on first access, in BGR or GRAY layout
+    @property
+    def image(self):
+        if self._image is None:
+            self._image = _echo.decodeImage(self.data, self.encoding, self.format, self.width, self.height)
+        return self._image
+
+    def decode(self):
+        return Frame(self.header, self.image, self.format)
+
+    @staticmethod
+    def read(reader):
+        obj = CompressedFrame()
+        obj.header = echolib.readType(echolib.Header, reader)
+        obj.encoding = FrameEncoding(ord(reader.readChar()))
+        obj.format = PixelFormat(ord(reader.readChar()))
+        obj.width = reader.readInt()
+        obj.height = reader.readInt()
+        obj.data = _echo.readBuffer(reader, reader.readLong())
+        return obj
+
+    @staticmethod
+    def write(writer, obj):
+        echolib.writeType(echolib.Header, writer, obj.header)
+        writer.writeChar(chr(int(obj.encoding)))
+        writer.writeChar(chr(int(obj.format)))
+        writer.writeInt(obj.width)
+        writer.writeInt(obj.height)
+        writer.writeLong(len(obj.data))
+        _echo.writeBuffer(writer, obj.data)
+
+echolib.registerType(CompressedFrame, CompressedFrame.read, CompressedFrame.write)
+
 class CameraIntrinsicsSubscriber(echolib.Subscriber):
 
     def __init__(self, client, alias, callback):
@@ -125,12 +188,14 @@ class CameraIntrinsicsPublisher(echolib.Publisher):
 
 class FrameSubscriber(echolib.Subscriber):
 
-    def __init__(self, client, alias, callback):
+    # Received images alias the message and are read-only unless copy is requested, a region
+    # such as "100:200,::2" is cut by the router
+    def __init__(self, client, alias, callback, copy=False, region=""):
         def _read(message):
-            reader = echolib.MessageReader(message)
+            reader = echolib.MessageReader(message, not copy)
             return Frame.read(reader)
 
-        super().__init__(client, alias, "camera frame", lambda x: callback(_read(x)))
+        super().__init__(client, alias, "camera frame", lambda x: callback(_read(x)), 0, 1, region)
 
 class FramePublisher(echolib.Publisher):
 
@@ -140,4 +205,24 @@ class FramePublisher(echolib.Publisher):
     def send(self, obj):
         writer = echolib.MessageWriter()
         Frame.write(writer, obj)
-        super().send(writer)
\ No newline at end of file
+        super().send(writer)
+
+class CompressedFrameSubscriber(echolib.Subscriber):
+
+    # The encoded data refers to the message, images are decoded only when accessed
+    def __init__(self, client, alias, callback):
+        def _read(message):
+            reader = echolib.MessageReader(message, True)
+            return CompressedFrame.read(reader)
+
+        super().__init__(client, alias, "compressed camera frame", lambda x: callback(_read(x)))
+
+class CompressedFramePublisher(echolib.Publisher):
+
+    def __init__(self, client, alias, queue=1):
+        super().__init__(client, alias, "compressed camera frame", queue)
+
+    def send(self, obj):
+        writer = echolib.MessageWriter()
+        CompressedFrame.write(writer, obj)
+        super().send(writer)
@@ -38,9 +38,11 @@ def remove_duplicates(seq):
 
 class Type(object):
 
-    def __init__(self, name, hash):
+    def __init__(self, name, hash, size=None, plain=False):
         self._name = name
         self._hash = hash
+        self._size = size
+        self._plain = plain
 
     def get_name(self):
         return self._name
@@ -60,9 +62,17 @@ class Type(object):
     def get_hash(self):
         return self._hash
 
+    def get_size(self):
+        """ Number of bytes that every value occupies on the wire, None if the length depends on the value """
+        return self._size
+
+    def is_plain(self):
+        """ True if the C++ value has the same representation in memory and on the wire, so it can be copied with memcpy """
+        return self._plain
+
 class ExternalType(Type):     
-    def __init__(self, name, container, default = None, reader = None, writer = None):
-        super(ExternalType, self).__init__(name, name)
+    def __init__(self, name, container, default = None, reader = None, writer = None, size = None, plain = False):
+        super(ExternalType, self).__init__(name, name, size, plain)
         self._default = default
         self._container = container
         self._reader = reader
@@ -126,19 +136,19 @@ class MessagesRegistry(object):
     def __init__(self):
         self.enums = OrderedDict()
         self.types = OrderedDict()
-        self.add_type(ExternalType("short", {"python" : "int", "cpp": "int16_t"}, 0))
-        self.add_type(ExternalType("int", {"python" : "int", "cpp": "int32_t"}, 0))
-        self.add_type(ExternalType("long", {"python" : "echolib.long", "cpp": "int64_t"}, 0))
-        self.add_type(ExternalType("float", {"python" : "float", "cpp": "float"}, 0.0))
-        self.add_type(ExternalType("double", {"python" : "echolib.double", "cpp": "double"}, 0.0))
-        self.add_type(ExternalType("bool", {"python" : "bool", "cpp": "bool"}, False))
-        self.add_type(ExternalType("char", {"python" : "echolib.char", "cpp": "char"}, '\0'))
+        self.add_type(ExternalType("short", {"python" : "int", "cpp": "int16_t"}, 0, size=2, plain=True))
+        self.add_type(ExternalType("int", {"python" : "int", "cpp": "int32_t"}, 0, size=4, plain=True))
+        self.add_type(ExternalType("long", {"python" : "echolib.long", "cpp": "int64_t"}, 0, size=8, plain=True))
+        self.add_type(ExternalType("float", {"python" : "float", "cpp": "float"}, 0.0, size=4, plain=True))
+        self.add_type(ExternalType("double", {"python" : "echolib.double", "cpp": "double"}, 0.0, size=8, plain=True))
+        self.add_type(ExternalType("bool", {"python" : "bool", "cpp": "bool"}, False, size=1))
+        self.add_type(ExternalType("char", {"python" : "echolib.char", "cpp": "char"}, '\0', size=1, plain=True))
         self.add_type(ExternalType("string", {"python" : "str", "cpp": "std::string"}, ""))
 
         self.add_type(ExternalType("timestamp", {
             "python" : "datetime.datetime",
             "cpp": "std::chrono::system_clock::time_point"
-        }))
+        }, size=8))
 
         self.add_type(ExternalType("header", {
             "python" : "echolib.Header",
@@ -186,7 +196,8 @@ class MessagesRegistry(object):
         typehash = hashlib.md5()
         for v in values:
             typehash.update(v.encode('utf-8'))
-        self.add_type(Type(name, typehash.hexdigest()))
+        # Enumerations are written as integers
+        self.add_type(Type(name, typehash.hexdigest(), 4))
         self.enums[name] = values
 
     def add_struct(self, name, fields):
@@ -197,9 +208,39 @@ class MessagesRegistry(object):
                 raise RuntimeError('Unknown type: ' + t)
             typehash.update(self.types[t].get_hash().encode('utf-8'))
 
-        self.add_type(Type(name, typehash.hexdigest()))
+        sizes = [self.get_field_size(v) for v in fields.values()]
+        size = None if None in sizes else sum(sizes)
+        plain = all(not v['array'] and self.types[v['type']].is_plain() for v in fields.values())
+
+        self.add_type(Type(name, typehash.hexdigest(), size, plain))
         self.structs[name] = fields
 
+    def get_field_size(self, field):
+        """ Wire length of a field, arrays are prefixed with their length and are never fixed """
+        if field['array']:
+            return None
+        return self.types[field['type']].get_size()
+
+    def get_constant_length(self, name):
+        """ Wire length of the fixed fields of a structure, including the length prefixes of arrays """
+        length = 0
+        for v in self.structs[name].values():
+            size = self.get_field_size(v)
+            if not size is None:
+                length += size
+            elif v['array']:
+                length += 4
+        return length
+
+    def get_offsets(self, name):
+        """ Wire offsets of the fields of a fixed length structure """
+        offsets = OrderedDict()
+        position = 0
+        for k, v in self.structs[name].items():
+            offsets[k] = position
+            position += self.get_field_size(v)
+        return offsets
+
     def add_message(self, name, fields):
         self.add_struct(name, fields)
         self.messages.append(name)
@@ -66,6 +66,9 @@ public:
     };
     
 	virtual ~{{ name }}() {};
+	{% if not registry.types[name].get_size() is none %}
+	static constexpr size_t WIRE_LENGTH = {{ registry.types[name].get_size() }};
+	{% endif %}
 	{% for k, v in fields.items() -%}
 	{% if v['array'] and v['length'] is none -%}
 	{{ registry.types[v["type"]].get_container() }} {{ k }}[{{ v['length'] }}];
@@ -109,6 +112,48 @@ template <> inline void write(MessageWriter& writer, const {{ cppnamespace }}{{
 
 
 {% for name, fields in registry.structs.items() %}
+{% set metadata = registry.types[name] %}
+{% if metadata.is_plain() %}
+{% set offsets = registry.get_offsets(name) %}
+// Fields are copied to constant offsets, the structure is transferred as a single block
+
+inline void encode(uchar* dst, const {{ cppnamespace }}{{ name }}& src) {
+	{% for k, v in fields.items() -%}
+	{% if v["type"] in registry.structs -%}
+	encode(dst + {{ offsets[k] }}, src.{{ k }});
+	{% else -%}
+	memcpy(dst + {{ offsets[k] }}, &src.{{ k }}, sizeof({{ registry.types[v["type"]].get_container() }}));
+	{% endif -%}
+	{%- endfor %}
+}
+
+inline void decode(const uchar* src, {{ cppnamespace }}{{ name }}& dst) {
+	{% for k, v in fields.items() -%}
+	{% if v["type"] in registry.structs -%}
+	decode(src + {{ offsets[k] }}, dst.{{ k }});
+	{% else -%}
+	memcpy(&dst.{{ k }}, src + {{ offsets[k] }}, sizeof({{ registry.types[v["type"]].get_container() }}));
+	{% endif -%}
+	{%- endfor %}
+}
+
+template <> inline void read(MessageReader& reader, {{ cppnamespace }}{{ name }}& dst) {
+	const uchar* span = reader.read_span({{ cppnamespace }}{{ name }}::WIRE_LENGTH);
+	if (span) {
+		decode(span, dst);
+		return;
+	}
+	uchar buffer[{{ cppnamespace }}{{ name }}::WIRE_LENGTH];
+	reader.copy_data(buffer, {{ cppnamespace }}{{ name }}::WIRE_LENGTH);
+	decode(buffer, dst);
+}
+
+template <> inline void write(MessageWriter& writer, const {{ cppnamespace }}{{ name }}& src) {
+	uchar buffer[{{ cppnamespace }}{{ name }}::WIRE_LENGTH];
+	encode(buffer, src);
+	writer.write_buffer(buffer, {{ cppnamespace }}{{ name }}::WIRE_LENGTH);
+}
+{% else %}
 template <> inline void read(MessageReader& reader, {{ cppnamespace }}{{ name }}& dst) {
 	{% for k, v in fields.items() -%}
 	read(reader, dst.{{ k }});
@@ -120,6 +165,27 @@ template <> inline void write(MessageWriter& writer, const {{ cppnamespace }}{{
 	write(writer, src.{{ k }});
 	{%- endfor %}
 }
+{% endif %}
+
+template <> inline size_t message_length(const {{ cppnamespace }}{{ name }}& src) {
+	{% if not metadata.get_size() is none -%}
+	return {{ cppnamespace }}{{ name }}::WIRE_LENGTH;
+	{%- else -%}
+	size_t length = {{ registry.get_constant_length(name) }};
+	{% for k, v in fields.items() -%}
+	{% if registry.get_field_size(v) is none -%}
+	{% if not v["array"] -%}
+	length += message_length(src.{{ k }});
+	{% elif not registry.types[v["type"]].get_size() is none -%}
+	length += src.{{ k }}.size() * {{ registry.types[v["type"]].get_size() }};
+	{% else -%}
+	for (const auto& item : src.{{ k }}) length += message_length(item);
+	{% endif -%}
+	{% endif -%}
+	{%- endfor %}
+	return length;
+	{%- endif %}
+}
 {% endfor %}
 
 {% for name in registry.messages %}
@@ -128,9 +194,15 @@ template <> inline void write(MessageWriter& writer, const {{ cppnamespace }}{{
 template <> inline string get_type_identifier<{{ cppnamespace }}{{ name }}>() { return string("{{ metadata.get_hash() }}"); }
 
 template<> inline shared_ptr<Message> echolib::Message::pack<{{ cppnamespace }}{{ name }} >(const {{ cppnamespace }}{{ name }} &data) {
-    MessageWriter writer;
+    {% if metadata.is_plain() -%}
+    shared_ptr<BufferedMessage> message = make_shared<BufferedMessage>((int) {{ cppnamespace }}{{ name }}::WIRE_LENGTH);
+    encode(message->get_buffer(), data);
+    return message;
+    {%- else -%}
+    MessageWriter writer(message_length(data));
     write(writer, data);
     return make_shared<BufferedMessage>(writer);
+    {%- endif %}
 }
 
 template<> inline shared_ptr<{{ cppnamespace }}{{ name }} > echolib::Message::unpack<{{ cppnamespace }}{{ name }}>(SharedMessage message) {
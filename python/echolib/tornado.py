@@ -27,16 +27,16 @@ try:
 
     _jpeg = TurboJPEG()
 
-    def _turbo_encode_jpeg(image):
-        return _jpeg.encode(image, quality=80, pixel_format=TJCS_RGB)
+    def _turbo_encode_jpeg(frame):
+        return _jpeg.encode(frame.convert(camera.PixelFormat.RGB), quality=80, pixel_format=TJCS_RGB)
 
     _encode_jpeg = _turbo_encode_jpeg
 
 except ImportError:
     try:
         import cv2
-        def _cv_encode_jpeg(image):
-            result, data = cv2.imencode('.jpg', image, [int(cv2.IMWRITE_JPEG_QUALITY), 80])
+        def _cv_encode_jpeg(frame):
+            result, data = cv2.imencode('.jpg', frame.convert(camera.PixelFormat.BGR), [int(cv2.IMWRITE_JPEG_QUALITY), 80])
             if result == False:
                 return None
             return bytes(data)
@@ -90,21 +90,33 @@ def uninstall_client(ioloop, client):
 
 class Image(object):
     def __init__(self, frame):
-        self._raw = frame.image
+        self._frame = frame
+        self._raw = None
         self._timestamp = frame.header.timestamp
         self._jpeg = None
+        # Frames that were compressed by the publisher are passed on without encoding them again
+        if isinstance(frame, camera.CompressedFrame):
+            if frame.encoding == camera.FrameEncoding.JPEG:
+                self._jpeg = bytes(frame.data)
+
+    def _decoded(self):
+        if isinstance(self._frame, camera.CompressedFrame):
+            self._frame = self._frame.decode()
+        return self._frame
 
     def raw(self):
+        if self._raw is None:
+            self._raw = self._decoded().convert(camera.PixelFormat.RGB)
         return self._raw
 
     def timestamp(self):
         return self._timestamp
 
     def jpeg(self):
-        if _encode_jpeg is None:
+        if self._jpeg is None and _encode_jpeg is None:
             raise RuntimeError("No support for JPEG encoding provided")
         if self._jpeg is None:
-            self._jpeg = _encode_jpeg(self._raw)
+            self._jpeg = _encode_jpeg(self._decoded())
         return self._jpeg
 
 class FutureCallback(object):
@@ -119,8 +131,10 @@ class FutureCallback(object):
         return await self._future
 
 class Camera(object):
-    def __init__(self, client, name):
+    # A compressed camera subscribes to the channel with frames that were already encoded by the publisher
+    def __init__(self, client, name, compressed=False):
         self.name = name
+        self._compressed = compressed
         self._image_listeners = []
         self._location_listeners = []
         self._client = client
@@ -146,7 +160,10 @@ class Camera(object):
     def listen_images(self, listener):
         self._image_listeners.append(listener)
         if len(self._image_listeners) == 1 and self._image_sub is None:
-            self._image_sub = camera.FrameSubscriber(self._client, "%s.image" % self.name,self._frame_callback)
+            if self._compressed:
+                self._image_sub = camera.CompressedFrameSubscriber(self._client, "%s.image.compressed" % self.name, self._frame_callback)
+            else:
+                self._image_sub = camera.FrameSubscriber(self._client, "%s.image" % self.name,self._frame_callback)
 
     def unlisten_images(self, listener):
         self._image_listeners.remove(listener)
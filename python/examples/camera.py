@@ -9,7 +9,7 @@ standard_library.install_aliases()
 from builtins import object
 import sys
 import echolib
-from echolib.camera import FramePublisher, Frame
+from echolib.camera import FramePublisher, Frame, PixelFormat
 import traceback
 
 try:
@@ -43,7 +43,7 @@ def main():
     try:
         while loop.wait(100):
             _, image = camera.read()
-            output.send(Frame(image=image))
+            output.send(Frame(image=image, format=PixelFormat.BGR))
 
     except Exception as e:
         traceback.print_exception(e)
@@ -10,13 +10,15 @@ standard_library.install_aliases()
 from builtins import object
 import sys
 import echolib
-from echolib.camera import FrameSubscriber
+from echolib.camera import FrameSubscriber, PixelFormat
 
 try:
     import cv2
 
     def display(frame):
-        canvas = cv2.cvtColor(frame.image, cv2.COLOR_RGB2BGR)
+        canvas = frame.convert(PixelFormat.BGR)
+        if not canvas.flags.writeable:
+            canvas = canvas.copy()
         cv2.putText(canvas, str(frame.header.timestamp), (10, 50), cv2.FONT_HERSHEY_SIMPLEX, 1.0, (255, 0, 0), 3)
         cv2.imshow("Image", canvas)
         cv2.waitKey(2)
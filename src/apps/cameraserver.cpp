@@ -12,6 +12,8 @@
 #include <echolib/loop.h>
 #include <echolib/camera.h>
 
+#include "pipeline.h"
+
 using namespace std;
 using namespace echolib;
 using namespace cv;
@@ -22,21 +24,33 @@ CameraIntrinsics parameters;
 
 int main(int argc, char** argv) {
 
-    int cameraid = (argc < 2 ? 0 : atoi(argv[1]));
+    // A synthetic test pattern can be used in place of a camera: echo_camera synthetic [width height]
+    bool synthetic = (argc > 1 && string(argv[1]) == "synthetic");
+
+    int cameraid = (argc < 2 || synthetic ? 0 : atoi(argv[1]));
 
     SharedClient client = echolib::connect(string(), "cameraserver");
 
     VideoCapture device;
-    Mat image, image_rgb;
+    Mat image;
 
-    device.open(cameraid);
-
-    if (!device.isOpened()) {
-        cerr << "Cannot open camera device " << cameraid << endl;
-        return -1;
+    double fps = 30;
+    if (getenv("LIMIT_FPS")) {
+        fps = min(1000.0, max(0.1, atof(getenv("LIMIT_FPS"))));
     }
 
-    device >> image;
+    if (synthetic) {
+        image = Mat::zeros(argc > 3 ? atoi(argv[3]) : 480, argc > 3 ? atoi(argv[2]) : 640, CV_8UC3);
+    } else {
+        device.open(cameraid);
+
+        if (!device.isOpened()) {
+            cerr << "Cannot open camera device " << cameraid << endl;
+            return -1;
+        }
+
+        device >> image;
+    }
 
     Matx33f intrinsics;
     Mat distortion;
@@ -61,42 +75,76 @@ int main(int argc, char** argv) {
     parameters.height = image.rows;
 
     SharedTypedPublisher<Frame> frame_publisher = make_shared<TypedPublisher<Frame> >(client, "camera", 1);
+    // Frames are encoded once for all subscribers of the compressed channel, e.g. the ones behind slow links
+    SharedTypedPublisher<CompressedFrame> compressed_publisher = make_shared<TypedPublisher<CompressedFrame> >(client, "camera.compressed", 1);
 
-    SubscriptionWatcher watcher(client, "camera");
+    // Frames in the pipeline rings and in the outgoing queue are recycled
+    SharedTensorPool pool = make_shared<TensorPool>(6);
 
     StaticPublisher<CameraIntrinsics> intrinsics_publisher = StaticPublisher<CameraIntrinsics>(client, "intrinsics", parameters);
 
-    double fps = 30;
-    if (getenv("LIMIT_FPS")) {
-        fps = min(1000.0, max(0.1, atof(getenv("LIMIT_FPS"))));
+    FrameSource source;
+
+    if (synthetic) {
+        source = SyntheticSource(image.cols, image.rows, fps);
+    } else {
+        source = [&](PipelineFrame& frame) {
+            SharedTensor raw = pool->get({(size_t) image.rows, (size_t) image.cols, (size_t) 3}, UINT8);
+            Mat target = raw->asMat();
+
+            if (!device.read(target) || target.empty()) return false;
+
+            // Backends that return their own buffer (or a different size) replace the header, the result is wrapped
+            frame.image = (target.data == raw->get_data()) ? raw : make_shared<Tensor>(target);
+            frame.timestamp = std::chrono::system_clock::now();
+            return true;
+        };
     }
 
-    std::chrono::system_clock::time_point a = std::chrono::system_clock::now();
-    std::chrono::system_clock::time_point b = std::chrono::system_clock::now();
+    // Frames are published in the BGR layout of the capture, consumers convert them only if they need to
+    FrameConverter converter = [](const SharedTensor& raw) {
+        return raw;
+    };
 
-    while (true) {
-        device >> image;
+    FrameSink sink = [&](const PipelineFrame& frame) {
+        Header header("camera", frame.timestamp);
+        if (frame_publisher->has_subscribers()) {
+            frame_publisher->send(Frame{header, frame.image, PIXEL_BGR});
+        }
+        if (frame.compressed) {
+            frame.compressed->header = header;
+            compressed_publisher->send(*frame.compressed);
+        }
+    };
 
-        a = std::chrono::system_clock::now();
-        std::chrono::duration<double, std::milli> work_time = a - b;
+    shared_ptr<FramePipeline> pipeline = make_shared<FramePipeline>(source, converter, sink);
 
-        b = a;
+    // The camera paces itself, the synthetic source is paced by its own rate
+    if (!synthetic) pipeline->set_rate(fps);
 
-        if (image.empty()) return -1;
+    pipeline->set_encoder(FrameCompressor(compressed_publisher));
+    pipeline->set_active([&]() { return frame_publisher->has_subscribers() || compressed_publisher->has_subscribers(); });
 
-        cv::cvtColor(image, image_rgb, COLOR_BGR2RGB);
+    pipeline->start();
 
-        if (watcher.get_subscribers() > 0) {
-            Frame frame{Header("camera", a), make_shared<Tensor>(image_rgb)};
-            frame_publisher->send(frame);
-        }
+    bool statistics = getenv("PIPELINE_STATS") != NULL;
+    std::chrono::steady_clock::time_point report = std::chrono::steady_clock::now();
 
-        std::chrono::duration<double, std::milli> delta_ms(max(0.0, 1000.0 / fps - (double)work_time.count()));
-        
-        auto delta_ms_duration = std::chrono::duration_cast<std::chrono::milliseconds>(delta_ms);
+    while (pipeline->is_running() && client->is_connected()) {
 
-        if (!echolib::wait(max(10, (int) delta_ms_duration.count()))) break;
+        if (!echolib::wait(100)) break;
+
+        if (statistics && std::chrono::steady_clock::now() - report > std::chrono::seconds(10)) {
+            report = std::chrono::steady_clock::now();
+            pipeline->print_counters(cout);
+        }
     }
 
-    exit(0);
+    bool failed = !pipeline->is_running();
+
+    pipeline->stop();
+
+    if (statistics) pipeline->print_counters(cout);
+
+    exit(failed ? -1 : 0);
 }
@@ -24,7 +24,7 @@ int main(int argc, char** argv) {
 
     SharedClient client = echolib::connect(string(), "imageserver");
  
-    Mat image = imread(filename.c_str()), image_rgb;
+    Mat image = imread(filename.c_str());
 
     if (image.empty()) {
         cerr << "Cannot open image file " << filename << endl;
@@ -51,20 +51,26 @@ int main(int argc, char** argv) {
     parameters.height = image.rows;
 
     SharedTypedPublisher<Frame> frame_publisher = make_shared<TypedPublisher<Frame> >(client, "camera", 1);
-
-    SubscriptionWatcher watcher(client, "camera");
+    SharedTypedPublisher<CompressedFrame> compressed_publisher = make_shared<TypedPublisher<CompressedFrame> >(client, "camera.compressed", 1);
 
     StaticPublisher<CameraIntrinsics> intrinsics_publisher = StaticPublisher<CameraIntrinsics>(client, "intrinsics", parameters);
 
-    cv::cvtColor(image, image_rgb, COLOR_BGR2RGB);
+    // The image is packed once, only the header with the timestamp is packed for every message
+    Frame frame{Header("image"), make_shared<Tensor>(image), PIXEL_BGR};
+    SharedMessage body = strip_header(Message::pack<Frame>(frame));
+    SharedMessage compressed = strip_header(Message::pack<CompressedFrame>(compress_frame(frame,
+        (getenv("COMPRESSION") && string(getenv("COMPRESSION")) == "png") ? ENCODING_PNG : ENCODING_JPEG)));
 
     while (true) {
         
-        if (watcher.get_subscribers() > 0) {
-            
-            Frame frame{Header("image"), make_shared<Tensor>(image_rgb)};
+        if (frame_publisher->has_subscribers()) {
+
+            frame_publisher->send(pack_with_header(Header("image"), body));
+
+        }
+        if (compressed_publisher->has_subscribers()) {
 
-            frame_publisher->send(frame);
+            compressed_publisher->send(pack_with_header(Header("image"), compressed));
 
         }
         if (!echolib::wait(30)) break;
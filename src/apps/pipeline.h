@@ -0,0 +1,478 @@
+#ifndef __ECHOLIB_APPS_PIPELINE_H
+#define __ECHOLIB_APPS_PIPELINE_H
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+#include <echolib/loop.h>
+#include <echolib/array.h>
+#include <echolib/datatypes.h>
+#include <echolib/camera.h>
+
+using namespace std;
+
+namespace echolib {
+
+typedef struct PipelineFrame {
+    SharedTensor image;
+    time_point timestamp;
+    shared_ptr<CompressedFrame> compressed;
+} PipelineFrame;
+
+// Returns false when the source has no more frames
+typedef function<bool(PipelineFrame&)> FrameSource;
+typedef function<SharedTensor(const SharedTensor&)> FrameConverter;
+typedef function<void(const PipelineFrame&)> FrameSink;
+// Returns an empty pointer when the frame does not have to be compressed
+typedef function<shared_ptr<CompressedFrame>(const PipelineFrame&)> FrameEncoder;
+
+/**
+ * A bounded queue between two stages, the oldest frame is dropped when the queue is full so that the next stage
+ * always gets the newest frames. A blocking queue waits for space instead.
+ */
+class FrameRing {
+public:
+    FrameRing(size_t capacity) : capacity(max((size_t) 1, capacity)), closed(false), blocking(false) {}
+
+    void set_blocking(bool blocking) {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->blocking = blocking;
+    }
+
+    // Returns the number of frames that were dropped to make space
+    size_t push(const PipelineFrame& frame) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        if (blocking) {
+            space.wait(lock, [this]() { return closed || frames.size() < capacity; });
+            if (closed) return 1;
+        }
+
+        size_t dropped = 0;
+        while (frames.size() >= capacity) {
+            frames.pop_front();
+            dropped++;
+        }
+
+        frames.push_back(frame);
+        available.notify_one();
+
+        return dropped;
+    }
+
+    // Waits for the oldest frame, returns false once the ring is closed and empty
+    bool pop(PipelineFrame& frame) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        available.wait(lock, [this]() { return closed || !frames.empty(); });
+
+        if (frames.empty()) return false;
+
+        frame = frames.front();
+        frames.pop_front();
+        space.notify_one();
+        return true;
+    }
+
+    // Takes a frame without waiting, up to skip older frames are dropped first and counted
+    bool take(PipelineFrame& frame, size_t skip, size_t& dropped) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        dropped = 0;
+        if (frames.empty()) return false;
+
+        dropped = min(skip, frames.size() - 1);
+        frames.erase(frames.begin(), frames.begin() + dropped);
+
+        frame = frames.front();
+        frames.pop_front();
+        space.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        closed = true;
+        available.notify_all();
+        space.notify_all();
+    }
+
+    bool is_closed() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        return closed && frames.empty();
+    }
+
+private:
+    size_t capacity;
+    bool closed;
+    bool blocking;
+
+    std::deque<PipelineFrame> frames;
+    std::mutex mutex;
+    std::condition_variable available;
+    std::condition_variable space;
+};
+
+class StageCounters {
+public:
+    StageCounters() : frames(0), dropped(0), stalled(0), total_time(0), max_time(0) {}
+
+    void record(std::chrono::steady_clock::duration duration) {
+        uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        frames++;
+        total_time += us;
+        uint64_t current = max_time;
+        while (us > current && !max_time.compare_exchange_weak(current, us)) {}
+    }
+
+    void drop(size_t count = 1) {
+        dropped += count;
+    }
+
+    // A frame was due but none was ready
+    void stall() {
+        stalled++;
+    }
+
+    void print(ostream& output, const string& name) const {
+        uint64_t count = frames;
+        output << name << ": " << count << " frames, " << dropped << " dropped, " << stalled << " stalled, " << std::fixed << std::setprecision(2)
+            << (count ? (double) total_time / count / 1000.0 : 0.0) << " ms avg, " << max_time / 1000.0 << " ms max" << endl;
+    }
+
+private:
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> stalled;
+    std::atomic<uint64_t> total_time;
+    std::atomic<uint64_t> max_time;
+};
+
+/**
+ * Runs capture and conversion in their own threads and hands the newest converted frame to the sink on the IO loop,
+ * so that a slow camera, a slow conversion and socket backpressure do not block each other. A lossless pipeline
+ * blocks the earlier stages instead of dropping frames, a paced pipeline hands over one frame per period.
+ */
+class FramePipeline : public IOBase {
+public:
+    FramePipeline(FrameSource source, FrameConverter converter, FrameSink sink, size_t capacity = 2) :
+        source(source), converter(converter), sink(sink), captured(capacity), converted(capacity),
+        running(false), interval(0), lossless(false), period(0), notifier(-1) {}
+
+    virtual ~FramePipeline() {
+        join();
+        if (notifier != -1) ::close(notifier);
+    }
+
+    void start(SharedIOLoop loop = default_loop()) {
+        if (running) return;
+
+        if (notifier == -1) {
+            // Paced pipelines are driven by a periodic timer, the others by an event from the conversion stage
+            if (period > 0) {
+                notifier = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+                struct itimerspec spec;
+                spec.it_interval.tv_sec = period / 1000000;
+                spec.it_interval.tv_nsec = (period % 1000000) * 1000;
+                spec.it_value = spec.it_interval;
+                if (notifier != -1 && timerfd_settime(notifier, 0, &spec, NULL) == -1) {
+                    ::close(notifier);
+                    notifier = -1;
+                }
+            } else {
+                notifier = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            }
+            if (notifier == -1) {
+                throw runtime_error("Unable to create pipeline notifier");
+            }
+        }
+
+        captured.set_blocking(lossless);
+        converted.set_blocking(lossless);
+
+        this->loop = loop;
+        running = true;
+
+        loop->add_handler(shared_from_this());
+
+        capture_thread = std::thread(&FramePipeline::capture, this);
+        convert_thread = std::thread(&FramePipeline::convert, this);
+    }
+
+    void stop() {
+        join();
+
+        if (loop) {
+            loop->remove_handler(shared_from_this());
+            loop.reset();
+        }
+    }
+
+    bool is_running() const {
+        return running;
+    }
+
+    /**
+     * Limits the rate of captured frames, frames that arrive too early are skipped. Zero disables the limit.
+     */
+    void set_rate(double fps) {
+        interval = (fps > 0) ? (int64_t) (1000000.0 / fps) : 0;
+    }
+
+    /**
+     * Earlier stages wait for the later ones instead of dropping frames, has to be set before the pipeline is started.
+     */
+    void set_lossless(bool lossless) {
+        this->lossless = lossless;
+    }
+
+    /**
+     * Hands over one frame per period on a timer, frames are skipped to catch up if the loop falls behind. Has to be
+     * set before the pipeline is started, zero hands over frames as soon as they are converted.
+     */
+    void set_pacing(double fps) {
+        period = (fps > 0) ? (int64_t) (1000000.0 / fps) : 0;
+    }
+
+    /**
+     * Compresses converted frames in the conversion thread, the sink gets the result in PipelineFrame::compressed so
+     * that a frame is encoded once for all subscribers. Has to be set before the pipeline is started.
+     */
+    void set_encoder(FrameEncoder encoder) {
+        this->encoder = encoder;
+    }
+
+    /**
+     * Conversion is skipped while the predicate returns false, e.g. when there are no subscribers.
+     */
+    void set_active(function<bool()> predicate) {
+        std::lock_guard<std::mutex> lock(active_mutex);
+        active = predicate;
+    }
+
+    void print_counters(ostream& output) const {
+        capture_counters.print(output, "capture");
+        convert_counters.print(output, "convert");
+        publish_counters.print(output, "publish");
+    }
+
+    virtual int get_file_descriptor() {
+        return notifier;
+    }
+
+    virtual bool handle_input() {
+        uint64_t value, count = 0;
+        while (::read(notifier, &value, sizeof(value)) > 0) count += value;
+
+        PipelineFrame frame;
+        size_t dropped = 0;
+
+        if (period > 0) {
+            // The timer counts the periods since the last read, missed ones are caught up by skipping frames
+            if (converted.take(frame, count > 0 ? count - 1 : 0, dropped)) {
+                publish(frame, dropped);
+            } else if (count > 0 && !converted.is_closed()) {
+                publish_counters.stall();
+            }
+        } else if (lossless) {
+            while (converted.take(frame, 0, dropped)) {
+                publish(frame, dropped);
+            }
+        } else if (converted.take(frame, SIZE_MAX, dropped)) {
+            publish(frame, dropped);
+        }
+
+        // Removes the handler from the loop once the source has finished
+        return !converted.is_closed();
+    }
+
+    virtual bool handle_output() {
+        return true;
+    }
+
+    virtual void disconnect() {
+        running = false;
+    }
+
+private:
+    void publish(const PipelineFrame& frame, size_t dropped) {
+        publish_counters.drop(dropped);
+
+        auto start = std::chrono::steady_clock::now();
+        sink(frame);
+        publish_counters.record(std::chrono::steady_clock::now() - start);
+    }
+
+    void join() {
+        running = false;
+
+        captured.close();
+        converted.close();
+
+        if (capture_thread.joinable()) capture_thread.join();
+        if (convert_thread.joinable()) convert_thread.join();
+    }
+
+    void notify() {
+        if (period > 0) return;
+
+        uint64_t value = 1;
+        if (::write(notifier, &value, sizeof(value)) < 0) {}
+    }
+
+    bool is_active() {
+        std::lock_guard<std::mutex> lock(active_mutex);
+        return !active || active();
+    }
+
+    void capture() {
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now();
+
+        while (running) {
+            PipelineFrame frame;
+
+            auto start = std::chrono::steady_clock::now();
+            if (!source(frame)) break;
+            auto end = std::chrono::steady_clock::now();
+
+            capture_counters.record(end - start);
+
+            int64_t limit = interval;
+            if (limit > 0) {
+                if (end < deadline) continue;
+                deadline = max(deadline + std::chrono::microseconds(limit), end);
+            }
+
+            capture_counters.drop(captured.push(frame));
+        }
+
+        running = false;
+        captured.close();
+    }
+
+    void convert() {
+        PipelineFrame frame;
+
+        while (captured.pop(frame)) {
+            if (!is_active()) continue;
+
+            auto start = std::chrono::steady_clock::now();
+            frame.image = converter(frame.image);
+            if (frame.image && encoder) frame.compressed = encoder(frame);
+            convert_counters.record(std::chrono::steady_clock::now() - start);
+
+            if (!frame.image) continue;
+
+            convert_counters.drop(converted.push(frame));
+            notify();
+        }
+
+        converted.close();
+        notify();
+    }
+
+    FrameSource source;
+    FrameConverter converter;
+    FrameSink sink;
+    FrameEncoder encoder;
+
+    FrameRing captured;
+    FrameRing converted;
+
+    std::atomic<bool> running;
+    std::atomic<int64_t> interval;
+    bool lossless;
+    int64_t period;
+
+    std::mutex active_mutex;
+    function<bool()> active;
+
+    StageCounters capture_counters;
+    StageCounters convert_counters;
+    StageCounters publish_counters;
+
+    std::thread capture_thread;
+    std::thread convert_thread;
+
+    SharedIOLoop loop;
+    int notifier;
+};
+
+/**
+ * Encodes BGR frames for a compressed channel while it has subscribers. The encoding is selected with the COMPRESSION
+ * environment variable (jpeg or png), COMPRESSION_QUALITY sets the JPEG quality or the PNG compression level.
+ */
+class FrameCompressor {
+public:
+    FrameCompressor(SharedTypedPublisher<CompressedFrame> publisher) : publisher(publisher), encoding(ENCODING_JPEG), quality(-1) {
+        const char* name = getenv("COMPRESSION");
+        if (name && string(name) == "png") encoding = ENCODING_PNG;
+        if (getenv("COMPRESSION_QUALITY")) quality = atoi(getenv("COMPRESSION_QUALITY"));
+    }
+
+    shared_ptr<CompressedFrame> operator()(const PipelineFrame& frame) {
+        if (!publisher->has_subscribers()) return shared_ptr<CompressedFrame>();
+        return make_shared<CompressedFrame>(compress_frame(Frame{Header(), frame.image, PIXEL_BGR}, encoding, quality));
+    }
+
+private:
+    SharedTypedPublisher<CompressedFrame> publisher;
+    FrameEncoding encoding;
+    int quality;
+};
+
+/**
+ * Generates a moving BGR test pattern at a fixed rate, used in place of a camera.
+ */
+class SyntheticSource {
+public:
+    SyntheticSource(size_t width, size_t height, double fps = 30) : width(width), height(height), counter(0),
+        interval((int64_t) (1000000.0 / max(0.1, fps))), pool(make_shared<TensorPool>(4)),
+        next(std::chrono::steady_clock::now()) {}
+
+    bool operator()(PipelineFrame& frame) {
+        std::this_thread::sleep_until(next);
+        next = max(next + std::chrono::microseconds(interval), std::chrono::steady_clock::now());
+
+        frame.image = pool->get({height, width, (size_t) 3}, UINT8);
+        frame.timestamp = std::chrono::system_clock::now();
+
+        uchar* data = frame.image->get_data();
+        for (size_t y = 0; y < height; y++) {
+            for (size_t x = 0; x < width; x++) {
+                data[0] = (uchar) (x + counter);
+                data[1] = (uchar) (y + counter);
+                data[2] = (uchar) (x + y);
+                data += 3;
+            }
+        }
+
+        counter++;
+
+        return true;
+    }
+
+private:
+    size_t width;
+    size_t height;
+    size_t counter;
+    int64_t interval;
+    SharedTensorPool pool;
+    std::chrono::steady_clock::time_point next;
+};
+
+}
+
+#endif
@@ -20,7 +20,11 @@ int main(int argc, char** argv) {
 
     SharedClient client = echolib::connect(string(), "videoclient");
 
+    // Frames from the compressed channel are received with: echo_client compressed
+    bool compressed = (argc > 1 && string(argv[1]) == "compressed");
+
     shared_ptr<Frame> frame;
+    shared_ptr<CompressedFrame> encoded;
     Mat canvas;
     bool incoming = false;
 
@@ -33,17 +37,32 @@ int main(int argc, char** argv) {
 
     };
 
-    SharedTypedSubscriber<Frame> frame_subscriber = make_shared<TypedSubscriber<Frame> >(client, "camera", frame_callback);
+    function<void(shared_ptr<CompressedFrame>)> compressed_callback = [&](shared_ptr<CompressedFrame> m) {
+
+        encoded = m;
+        incoming = true;
+
+    };
+
+    SharedTypedSubscriber<Frame> frame_subscriber;
+    SharedTypedSubscriber<CompressedFrame> compressed_subscriber;
+
+    if (compressed) {
+        compressed_subscriber = make_shared<TypedSubscriber<CompressedFrame> >(client, "camera.compressed", compressed_callback);
+    } else {
+        frame_subscriber = make_shared<TypedSubscriber<Frame> >(client, "camera", frame_callback);
+    }
 
     while (true) {
 
         if (incoming) {
 
-            std::time_t tt = std::chrono::system_clock::to_time_t ( frame->header.timestamp );
+            std::time_t tt = std::chrono::system_clock::to_time_t ( compressed ? encoded->header.timestamp : frame->header.timestamp );
 
             if (!headless) {
-                Mat image = frame->image->asMat();
-                cv::cvtColor(image, canvas, COLOR_RGB2BGR);
+                // Received frames are owned by the client, so the text can be drawn directly on them
+                // Compressed frames are only decoded when they are displayed
+                canvas = compressed ? decompress_frame(*encoded)->asMat() : convert_image(frame->image, frame->format, PIXEL_BGR)->asMat();
                 cv::putText(canvas, ctime(&tt), Point(10, 50), FONT_HERSHEY_SIMPLEX, 1.0, Scalar(255, 0, 0), 3);
                 imshow("Image", canvas);
             }
@@ -10,6 +10,8 @@
 #include <echolib/helpers.h>
 #include <echolib/camera.h>
 
+#include "pipeline.h"
+
 using namespace std;
 using namespace echolib;
 using namespace cv;
@@ -18,13 +20,23 @@ CameraIntrinsics parameters;
 
 #define READ_MATX(N, M) { Mat tmp; (N) >> tmp; (M) = tmp; }
 
+// Number of frames that are decoded ahead
+#define DECODE_AHEAD 4
+
 int main(int argc, char** argv) {
 
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " video [fps | max]" << endl;
+        return -1;
+    }
+
     string filename(argv[1]);
 
-    SharedClient client = echolib::connect(string(), "videoserver");
+    // Frames are published at the rate of the file by default, "max" publishes them as fast as they are decoded
+    string rate = (argc > 2) ? string(argv[2]) : string();
+    bool max_speed = (rate == "max");
 
-    Mat image, image_rgb;
+    SharedClient client = echolib::connect(string(), "videoserver");
 
     VideoCapture video(filename);
 
@@ -32,6 +44,10 @@ int main(int argc, char** argv) {
         cerr << "Cannot open image file " << filename << endl;
         return -1;
     }
+
+    double fps = (rate.empty() || max_speed) ? video.get(CAP_PROP_FPS) : atof(rate.c_str());
+    if (!(fps > 0)) fps = 30;
+    fps = min(1000.0, fps);
     
     Matx33f intrinsics;
     Mat distortion;
@@ -56,30 +72,81 @@ int main(int argc, char** argv) {
     parameters.height = video.get(CAP_PROP_FRAME_HEIGHT);
 
     SharedTypedPublisher<Frame> frame_publisher = make_shared<TypedPublisher<Frame> >(client, "camera", 1);
+    // Frames are encoded once for all subscribers of the compressed channel, e.g. the ones behind slow links
+    SharedTypedPublisher<CompressedFrame> compressed_publisher = make_shared<TypedPublisher<CompressedFrame> >(client, "camera.compressed", 1);
 
-    SubscriptionWatcher watcher(client, "camera");
+    // Decoded and converted frames in the queues are recycled
+    SharedTensorPool pool = make_shared<TensorPool>(2 * DECODE_AHEAD + 2);
 
     StaticPublisher<CameraIntrinsics> intrinsics_publisher = StaticPublisher<CameraIntrinsics>(client, "intrinsics", parameters);
 
-    while (true) {
-        video >> image;
+    std::atomic<bool> quit(false);
+
+    FrameSource source = [&](PipelineFrame& frame) {
+
+        // Replay is paused while nobody is watching
+        while (!frame_publisher->has_subscribers() && !compressed_publisher->has_subscribers()) {
+            if (quit) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        SharedTensor raw = pool->get({(size_t) parameters.height, (size_t) parameters.width, (size_t) 3}, UINT8);
+        Mat target = raw->asMat();
 
-        if (image.empty()) {
+        if (!video.read(target) || target.empty()) {
+            // Rewind at the end of the file
             video.set(CAP_PROP_POS_FRAMES, 0);
-            continue;
+            if (!video.read(target) || target.empty()) return false;
         }
 
-        cv::cvtColor(image, image_rgb, COLOR_BGR2RGB);
+        frame.image = (target.data == raw->get_data()) ? raw : make_shared<Tensor>(target);
+        frame.timestamp = std::chrono::system_clock::now();
+        return true;
+    };
 
-        std::chrono::system_clock::time_point a = std::chrono::system_clock::now();
+    // Frames are published in the BGR layout of the capture, consumers convert them only if they need to
+    FrameConverter converter = [](const SharedTensor& raw) {
+        return raw;
+    };
 
-        if (watcher.get_subscribers() > 0) {
-            Frame frame{Header("video", a), make_shared<Tensor>(image_rgb)};
+    FrameSink sink = [&](const PipelineFrame& frame) {
+        Header header("video", std::chrono::system_clock::now());
+        if (frame_publisher->has_subscribers()) {
+            frame_publisher->send(Frame{header, frame.image, PIXEL_BGR});
+        }
+        if (frame.compressed) {
+            frame.compressed->header = header;
+            compressed_publisher->send(*frame.compressed);
+        }
+    };
+
+    shared_ptr<FramePipeline> pipeline = make_shared<FramePipeline>(source, converter, sink, DECODE_AHEAD);
+
+    // Frames are decoded ahead and never dropped, only the publishing is paced
+    pipeline->set_encoder(FrameCompressor(compressed_publisher));
+    pipeline->set_lossless(true);
+    pipeline->set_pacing(max_speed ? 0 : fps);
+
+    pipeline->start();
+
+    bool statistics = getenv("PIPELINE_STATS") != NULL;
+    std::chrono::steady_clock::time_point report = std::chrono::steady_clock::now();
 
-            frame_publisher->send(frame);
+    while (pipeline->is_running() && client->is_connected()) {
+
+        if (!echolib::wait(100)) break;
+
+        if (statistics && std::chrono::steady_clock::now() - report > std::chrono::seconds(10)) {
+            report = std::chrono::steady_clock::now();
+            pipeline->print_counters(cout);
         }
-        if (!echolib::wait(30)) break;
     }
 
+    quit = true;
+
+    pipeline->stop();
+
+    if (statistics) pipeline->print_counters(cout);
+
     exit(0);
 }
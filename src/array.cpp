@@ -5,11 +5,20 @@
 #include <fstream>
 #include <cmath>
 #include <type_traits>
+#include <atomic>
+#include <cstdlib>
+
+#include <sys/mman.h>
 
 #ifdef BUILD_OPENCV
 #include <opencv2/opencv.hpp>
 #endif
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define __ECHOLIB_F16C_DISPATCH 1
+#endif
+
 #include "debug.h"
 #include <echolib/array.h>
 
@@ -18,9 +27,33 @@ using namespace echolib;
 
 namespace echolib {
 
+static std::atomic<size_t> array_alignment(ARRAY_ALIGNMENT);
+static std::atomic<size_t> array_huge_page_threshold(ARRAY_HUGE_PAGE_THRESHOLD);
+
+static uchar* allocate_array(size_t size) {
+
+    size_t alignment = max(array_alignment.load(), sizeof(void*));
+    size_t threshold = array_huge_page_threshold.load();
+    bool huge = threshold > 0 && size >= threshold;
+
+    if (huge) alignment = max(alignment, (size_t) ARRAY_HUGE_PAGE_SIZE);
+
+    void* ptr = NULL;
+
+    if (posix_memalign(&ptr, alignment, max(size, (size_t) 1)) != 0)
+        throw std::bad_alloc();
+
+#ifdef MADV_HUGEPAGE
+    // Only a hint, the kernel may ignore it if transparent huge pages are disabled
+    if (huge) madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+
+    return (uchar*) ptr;
+}
+
 Array::Array(): Array(0) {}
 
-Array::Array(size_t size): size(size), data((uchar*) malloc(size)), callback(nullptr) {
+Array::Array(size_t size): size(size), data(allocate_array(size)), callback(nullptr) {
 
 }
 
@@ -47,6 +80,38 @@ uchar* Array::get_data() const {
     return data;
 }
 
+bool Array::is_contiguous() const {
+    return true;
+}
+
+void Array::set_alignment(size_t alignment) {
+
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+        throw runtime_error("Alignment must be a power of two");
+
+    array_alignment = alignment;
+}
+
+size_t Array::get_alignment() {
+    return array_alignment;
+}
+
+void Array::set_huge_page_threshold(size_t threshold) {
+    array_huge_page_threshold = threshold;
+}
+
+size_t Array::get_huge_page_threshold() {
+    return array_huge_page_threshold;
+}
+
+size_t Array::copy_data(size_t position, uchar* buffer, size_t length) const {
+    if (position >= size) return 0;
+    length = min(length, size - position);
+
+    memcpy(buffer, &(data[position]), length);
+    return length;
+}
+
 size_t multiply_dimensions(echolib::any_container<size_t> dims) {
 
     if (dims->size() == 0) return 0;
@@ -64,11 +129,14 @@ size_t Tensor::get_type_bytes(DataType dtype) {
 
     switch (dtype) {
         case UINT8:
-        case INT8: {
+        case INT8:
+        case BOOL: {
             return 1;
         }
         case UINT16:
-        case INT16: {
+        case INT16:
+        case FLOAT16:
+        case BFLOAT16: {
             return 2;
         }
         case UINT32:
@@ -78,23 +146,56 @@ size_t Tensor::get_type_bytes(DataType dtype) {
         case FLOAT32: {
             return 4;
         }
+        case UINT64:
+        case INT64:
         case FLOAT64: {
             return 8;
         }
+        case BIT: {
+            return 0;
+        }
     }
 
     throw runtime_error("Unsupported data type");
 }
 
+size_t Tensor::get_storage_size(DataType dtype, size_t elements) {
+
+    if (dtype == BIT)
+        return (elements + 7) / 8;
+
+    return elements * get_type_bytes(dtype);
+}
+
 
 Tensor::Tensor() : Tensor({}, UINT8) {}
 
-Tensor::Tensor(echolib::any_container<size_t> dims, DataType dtype) : Array(multiply_dimensions(dims) * Tensor::get_type_bytes(dtype)), dimensions(dims->begin(), dims->end()), dtype(dtype)  {
+Tensor::Tensor(echolib::any_container<size_t> dims, DataType dtype) : Array(Tensor::get_storage_size(dtype, multiply_dimensions(dims))), dimensions(dims->begin(), dims->end()), dtype(dtype)  {
 
 }
 
 
-Tensor::Tensor(echolib::any_container<size_t> dims, DataType dtype, uchar* data, DescructorCallback callback) : Array(multiply_dimensions(dims) * Tensor::get_type_bytes(dtype), data, callback), dimensions(dims->begin(), dims->end()), dtype(dtype) {
+Tensor::Tensor(echolib::any_container<size_t> dims, DataType dtype, uchar* data, DescructorCallback callback) : Array(Tensor::get_storage_size(dtype, multiply_dimensions(dims)), data, callback), dimensions(dims->begin(), dims->end()), dtype(dtype) {
+
+}
+
+Tensor::Tensor(echolib::any_container<size_t> dims, DataType dtype, uchar* data, echolib::any_container<ssize_t> strides, DescructorCallback callback) : Tensor(dims, dtype, data, callback) {
+
+    if (strides->size() != dimensions.size())
+        throw runtime_error("Number of strides does not match number of dimensions");
+
+    if (dtype == BIT)
+        throw runtime_error("Bit tensors cannot be strided");
+
+    ssize_t packed = (ssize_t) get_type_bytes(dtype);
+
+    for (ssize_t i = (ssize_t) dimensions.size() - 1; i >= 0; i--) {
+        if (dimensions[i] > 1 && (*strides)[i] != packed) {
+            steps.assign(strides->begin(), strides->end());
+            break;
+        }
+        packed *= (ssize_t) dimensions[i];
+    }
 
 }
 
@@ -108,6 +209,52 @@ Tensor::~Tensor() {
 const int CV_MAX_DIM = 32;
 #endif
 
+#if CV_VERSION_MAJOR >= 4
+typedef cv::AccessFlag MatAccessFlags;
+#else
+typedef int MatAccessFlags;
+#endif
+
+// Mats returned by asMat() reference their tensor through UMatData, the allocator releases the reference when
+// the last Mat is gone, other allocations are delegated to the standard allocator
+class TensorMatAllocator : public cv::MatAllocator {
+public:
+
+    cv::UMatData* wrap(shared_ptr<const Tensor> tensor, uchar* data, size_t size) const {
+
+        cv::UMatData* u = new cv::UMatData(this);
+        u->data = u->origdata = data;
+        u->size = size;
+        u->userdata = new shared_ptr<const Tensor>(tensor);
+
+        return u;
+    }
+
+    virtual cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, MatAccessFlags flags, cv::UMatUsageFlags usage) const {
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage);
+    }
+
+    virtual bool allocate(cv::UMatData* u, MatAccessFlags flags, cv::UMatUsageFlags usage) const {
+        return cv::Mat::getStdAllocator()->allocate(u, flags, usage);
+    }
+
+    virtual void deallocate(cv::UMatData* u) const {
+
+        // A UMat derived from the Mat may still reference the data
+        if (!u || u->refcount > 0 || u->urefcount > 0) return;
+
+        delete (shared_ptr<const Tensor>*) u->userdata;
+        delete u;
+    }
+
+};
+
+static const TensorMatAllocator* get_tensor_allocator() {
+    // Never destroyed, Mats may outlive static destructors
+    static const TensorMatAllocator* allocator = new TensorMatAllocator();
+    return allocator;
+}
+
 DataType Tensor::decode_ocvtype(int cvtype) {
 
     int depth = CV_MAT_DEPTH(cvtype);
@@ -122,6 +269,21 @@ DataType Tensor::decode_ocvtype(int cvtype) {
         case CV_32S: { dtype = INT32; break; }
         case CV_32F: { dtype = FLOAT32; break; }
         case CV_64F: { dtype = FLOAT64; break; }
+#ifdef CV_16F
+        case CV_16F: { dtype = FLOAT16; break; }
+#endif
+#ifdef CV_16BF
+        case CV_16BF: { dtype = BFLOAT16; break; }
+#endif
+#ifdef CV_64S
+        case CV_64S: { dtype = INT64; break; }
+#endif
+#ifdef CV_64U
+        case CV_64U: { dtype = UINT64; break; }
+#endif
+#ifdef CV_Bool
+        case CV_Bool: { dtype = BOOL; break; }
+#endif
         default: {
             throw runtime_error("Unsupported data type");
         }
@@ -142,6 +304,23 @@ int Tensor::encode_ocvtype(DataType dtype) {
         case INT32: { type = CV_32S; break; }
         case FLOAT32: { type = CV_32F; break; }
         case FLOAT64: { type = CV_64F; break; }
+#ifdef CV_16F
+        case FLOAT16: { type = CV_16F; break; }
+#endif
+#ifdef CV_16BF
+        case BFLOAT16: { type = CV_16BF; break; }
+#endif
+#ifdef CV_64S
+        case INT64: { type = CV_64S; break; }
+#endif
+#ifdef CV_64U
+        case UINT64: { type = CV_64U; break; }
+#endif
+#ifdef CV_Bool
+        case BOOL: { type = CV_Bool; break; }
+#else
+        case BOOL: { type = CV_8U; break; }
+#endif
         default: {
             throw runtime_error("Unsupported data type");
         }
@@ -150,22 +329,12 @@ int Tensor::encode_ocvtype(DataType dtype) {
     return type;
 }
 
-Tensor::Tensor(cv::Mat source) {
-
-    if (!source.isContinuous()) 
-        source = source.clone(); // Copy data in case of strides
-
-    data = source.data;
+// Channels of a Mat are the last dimension of the tensor
+static vector<size_t> mat_dimensions(const cv::Mat& source) {
 
-    cv::Mat* reservation = new cv::Mat(source); // A dynamically allocated Mat, used to keep data in memory.
-    callback = [reservation](){ delete reservation; };
-
-    //int depth = CV_MAT_DEPTH(source.type());
     int cn = CV_MAT_CN(source.type());
 
-    dtype = decode_ocvtype(source.type());
-
-    dimensions = vector<size_t>(source.dims + (cn > 1 ? 1 : 0));
+    vector<size_t> dimensions(source.dims + (cn > 1 ? 1 : 0));
 
     for (int i = 0; i < source.dims; i++) {
         dimensions[i] = source.size[i];
@@ -174,16 +343,31 @@ Tensor::Tensor(cv::Mat source) {
     if (cn > 1)
         dimensions[source.dims] = cn;
 
-    size = 0;
+    return dimensions;
+
+}
 
-    if (dimensions.size() > 0) {
-        size = 1;
-        for (size_t d : dimensions) { size *= d; }
+// Regions of interest are kept strided and gathered when sent
+static vector<ssize_t> mat_strides(const cv::Mat& source) {
+
+    int cn = CV_MAT_CN(source.type());
+
+    vector<ssize_t> strides(source.dims + (cn > 1 ? 1 : 0));
+
+    for (int i = 0; i < source.dims; i++) {
+        strides[i] = (ssize_t) source.step[i];
     }
 
-    size *= get_type_bytes(dtype);
+    if (cn > 1)
+        strides[source.dims] = (ssize_t) source.elemSize1();
 
-    data = source.data;
+    return strides;
+
+}
+
+// The Mat is copied to keep its data in memory, the tensor does not allocate storage of its own
+Tensor::Tensor(cv::Mat source) : Tensor(mat_dimensions(source), decode_ocvtype(source.type()), source.data, mat_strides(source),
+        [reservation = new cv::Mat(source)]() { delete reservation; }) {
 
 }
 
@@ -205,7 +389,43 @@ cv::Mat Tensor::asMat() const {
         type |= CV_MAKETYPE(0, size[2]);
     }
 
-    return cv::Mat(ndims, size, type, data);
+    cv::Mat result;
+
+    if (steps.empty()) {
+        result = cv::Mat(ndims, size, type, data);
+        return share_data(result);
+    }
+
+    // Channels are folded into the element type and have to be packed
+    if (ndims < (int) dimensions.size() && steps[2] != (ssize_t) get_type_bytes(dtype))
+        throw runtime_error("Channel stride is not supported by OpenCV");
+
+    size_t mat_steps[CV_MAX_DIM];
+    for (int i = 0; i < ndims; i++) {
+        if (steps[i] < 0)
+            throw runtime_error("Negative strides are not supported by OpenCV");
+        mat_steps[i] = (size_t) steps[i];
+    }
+
+    // The step of the last dimension is implied by the element size
+    if (ndims > 0 && size[ndims - 1] > 1 && mat_steps[ndims - 1] != (size_t) CV_ELEM_SIZE(type))
+        throw runtime_error("Element stride is not supported by OpenCV");
+
+    result = cv::Mat(ndims, size, type, data, mat_steps);
+    return share_data(result);
+
+}
+
+cv::Mat Tensor::share_data(cv::Mat& mat) const {
+
+    shared_ptr<const Tensor> self = weak_from_this().lock();
+
+    if (!self || mat.empty()) return mat;
+
+    mat.u = get_tensor_allocator()->wrap(self, (uchar*) mat.datastart, (size_t) (mat.dataend - mat.datastart));
+    mat.addref();
+
+    return mat;
 
 }
 
@@ -219,6 +439,77 @@ uchar Tensor::ndims() const {
     return (uchar) dimensions.size();
 }
 
+ssize_t Tensor::stride(size_t i) const {
+
+    if (!steps.empty()) return steps[i];
+
+    ssize_t packed = (ssize_t) get_type_bytes(dtype);
+    for (size_t j = i + 1; j < dimensions.size(); j++) {
+        packed *= (ssize_t) dimensions[j];
+    }
+    return packed;
+}
+
+const std::vector<ssize_t> Tensor::strides() const {
+
+    vector<ssize_t> result(dimensions.size());
+    for (size_t i = 0; i < dimensions.size(); i++) {
+        result[i] = stride(i);
+    }
+    return result;
+}
+
+bool Tensor::is_contiguous() const {
+    return steps.empty();
+}
+
+size_t Tensor::copy_data(size_t position, uchar* buffer, size_t length) const {
+
+    if (steps.empty()) return Array::copy_data(position, buffer, length);
+
+    if (position >= size) return 0;
+    length = min(length, size - position);
+
+    // Trailing dimensions that are packed are copied as a single run
+    size_t run = get_type_bytes(dtype);
+    size_t outer = dimensions.size();
+    while (outer > 0 && (dimensions[outer - 1] == 1 || steps[outer - 1] == (ssize_t) run)) {
+        run *= dimensions[outer - 1];
+        outer--;
+    }
+
+    vector<size_t> index(outer);
+    size_t block = position / run;
+    size_t offset = position % run;
+
+    for (size_t i = outer; i > 0; i--) {
+        index[i - 1] = block % dimensions[i - 1];
+        block /= dimensions[i - 1];
+    }
+
+    size_t copied = 0;
+
+    while (copied < length) {
+
+        const uchar* source = data;
+        for (size_t i = 0; i < outer; i++) {
+            source += (ssize_t) index[i] * steps[i];
+        }
+
+        size_t chunk = min(run - offset, length - copied);
+        memcpy(buffer + copied, source + offset, chunk);
+        copied += chunk;
+        offset = 0;
+
+        for (size_t i = outer; i > 0; i--) {
+            if (++index[i - 1] < dimensions[i - 1]) break;
+            index[i - 1] = 0;
+        }
+    }
+
+    return copied;
+}
+
 const std::vector<size_t> Tensor::dims() const {
     return move(dimensions);
 }
@@ -227,10 +518,411 @@ DataType Tensor::get_type() const {
     return dtype;
 }
 
+SharedTensor Tensor::view(uchar* origin, vector<size_t> dimensions, vector<ssize_t> strides) const {
+
+    if (dtype == BIT)
+        throw runtime_error("Views of bit tensors are not supported");
+
+    shared_ptr<const Tensor> parent = shared_from_this();
+
+    return make_shared<Tensor>(dimensions, dtype, origin, strides, [parent]() {});
+
+}
+
+SharedTensor Tensor::slice(size_t dimension, size_t start, size_t end, size_t step) const {
+
+    if (dimension >= dimensions.size() || start > end || end > dimensions[dimension] || step < 1)
+        throw runtime_error("Slice out of range");
+
+    vector<size_t> shape(dimensions);
+    shape[dimension] = (end - start + step - 1) / step;
+
+    vector<ssize_t> offsets = strides();
+    offsets[dimension] *= (ssize_t) step;
+
+    return view(data + (ssize_t) start * stride(dimension), shape, offsets);
+
+}
+
+SharedTensor Tensor::select(size_t dimension, size_t index) const {
+
+    if (dimension >= dimensions.size() || index >= dimensions[dimension])
+        throw runtime_error("Index out of range");
+
+    if (dimensions.size() < 2)
+        throw runtime_error("Cannot select from a one-dimensional tensor");
+
+    vector<size_t> shape(dimensions);
+    vector<ssize_t> offsets = strides();
+
+    ssize_t offset = (ssize_t) index * offsets[dimension];
+    shape.erase(shape.begin() + dimension);
+    offsets.erase(offsets.begin() + dimension);
+
+    return view(data + offset, shape, offsets);
+
+}
+
+SharedTensor Tensor::crop(echolib::any_container<size_t> offset, echolib::any_container<size_t> size) const {
+
+    if (offset->size() != size->size() || offset->size() > dimensions.size())
+        throw runtime_error("Region does not match dimensions");
+
+    vector<size_t> shape(dimensions);
+    ssize_t origin = 0;
+
+    for (size_t i = 0; i < offset->size(); i++) {
+        if ((*offset)[i] + (*size)[i] > dimensions[i])
+            throw runtime_error("Region out of range");
+        shape[i] = (*size)[i];
+        origin += (ssize_t) (*offset)[i] * stride(i);
+    }
+
+    return view(data + origin, shape, strides());
+
+}
+
 uchar Tensor::get_bytes() {
     return Tensor::get_type_bytes(dtype);
 }
 
+static inline uint32_t float_bits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(float));
+    return bits;
+}
+
+static inline float bits_float(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(float));
+    return value;
+}
+
+// Scalar IEEE half precision conversions, the rounding is done by the float unit
+static inline uint16_t float_to_half(float value) {
+
+    const uint32_t w = float_bits(value);
+    const uint32_t shl1_w = w + w;
+    const uint32_t sign = w & 0x80000000u;
+
+    // Scaling up and down saturates overflows to infinity and rounds the mantissa to 10 bits
+    float base = (fabsf(value) * 0x1.0p+112f) * 0x1.0p-110f;
+
+    uint32_t bias = shl1_w & 0xFF000000u;
+    if (bias < 0x71000000u) bias = 0x71000000u;
+
+    base = bits_float((bias >> 1) + 0x07800000u) + base;
+
+    const uint32_t bits = float_bits(base);
+    const uint32_t nonsign = ((bits >> 13) & 0x00007C00u) + (bits & 0x00000FFFu);
+
+    return (uint16_t) ((sign >> 16) | (shl1_w > 0xFF000000u ? 0x7E00u : nonsign));
+}
+
+static inline float half_to_float(uint16_t value) {
+
+    const uint32_t w = (uint32_t) value << 16;
+    const uint32_t sign = w & 0x80000000u;
+    const uint32_t two_w = w + w;
+
+    const float normalized = bits_float((two_w >> 4) + (0xE0u << 23)) * 0x1.0p-112f;
+    const float denormalized = bits_float((two_w >> 17) | (126u << 23)) - 0.5f;
+
+    return bits_float(sign | (two_w < (1u << 27) ? float_bits(denormalized) : float_bits(normalized)));
+}
+
+#ifdef __ECHOLIB_F16C_DISPATCH
+
+static bool has_f16c() {
+    static const bool supported = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+    return supported;
+}
+
+__attribute__((target("avx,f16c")))
+static size_t float32_to_float16_f16c(const float* src, uint16_t* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm_storeu_si128((__m128i*) (dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+    return i;
+}
+
+__attribute__((target("avx,f16c")))
+static size_t float16_to_float32_f16c(const uint16_t* src, float* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (src + i))));
+    }
+    return i;
+}
+
+#endif
+
+void convert_float32_to_float16(const float* src, uint16_t* dst, size_t count) {
+
+    size_t i = 0;
+
+#ifdef __ECHOLIB_F16C_DISPATCH
+    if (has_f16c()) i = float32_to_float16_f16c(src, dst, count);
+#endif
+
+    for (; i < count; i++) dst[i] = float_to_half(src[i]);
+}
+
+void convert_float16_to_float32(const uint16_t* src, float* dst, size_t count) {
+
+    size_t i = 0;
+
+#ifdef __ECHOLIB_F16C_DISPATCH
+    if (has_f16c()) i = float16_to_float32_f16c(src, dst, count);
+#endif
+
+    for (; i < count; i++) dst[i] = half_to_float(src[i]);
+}
+
+// Plain loops over bits, these are vectorized by the compiler
+void convert_float32_to_bfloat16(const float* src, uint16_t* dst, size_t count) {
+
+    for (size_t i = 0; i < count; i++) {
+        uint32_t bits = float_bits(src[i]);
+        // Round to nearest even, NaNs are kept quiet
+        uint32_t rounded = (bits + 0x7FFFu + ((bits >> 16) & 1u)) >> 16;
+        dst[i] = (uint16_t) (((bits & 0x7FFFFFFFu) > 0x7F800000u) ? ((bits >> 16) | 0x40u) : rounded);
+    }
+}
+
+void convert_bfloat16_to_float32(const uint16_t* src, float* dst, size_t count) {
+
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = bits_float((uint32_t) src[i] << 16);
+    }
+}
+
+SharedTensor Tensor::convert(DataType target) const {
+
+    if (target == dtype)
+        return const_pointer_cast<Tensor>(shared_from_this());
+
+    // Conversions work on packed data, strided tensors are gathered first
+    shared_ptr<const Tensor> source = shared_from_this();
+    if (!is_contiguous()) {
+        SharedTensor packed = make_shared<Tensor>(dimensions, dtype);
+        copy_data(0, packed->get_data(), size);
+        source = packed;
+    }
+
+    SharedTensor result = make_shared<Tensor>(dimensions, target);
+    size_t count = multiply_dimensions(dimensions);
+    const uchar* input = source->get_data();
+    uchar* output = result->get_data();
+
+    if (dtype == FLOAT32 && target == FLOAT16) {
+        convert_float32_to_float16((const float*) input, (uint16_t*) output, count);
+    } else if (dtype == FLOAT16 && target == FLOAT32) {
+        convert_float16_to_float32((const uint16_t*) input, (float*) output, count);
+    } else if (dtype == FLOAT32 && target == BFLOAT16) {
+        convert_float32_to_bfloat16((const float*) input, (uint16_t*) output, count);
+    } else if (dtype == BFLOAT16 && target == FLOAT32) {
+        convert_bfloat16_to_float32((const uint16_t*) input, (float*) output, count);
+    } else if ((dtype == BOOL || dtype == UINT8) && target == BIT) {
+        memset(output, 0, result->get_size());
+        for (size_t i = 0; i < count; i++) {
+            if (input[i]) output[i >> 3] |= (uchar) (0x80 >> (i & 7));
+        }
+    } else if (dtype == BIT && (target == BOOL || target == UINT8)) {
+        for (size_t i = 0; i < count; i++) {
+            output[i] = (input[i >> 3] >> (7 - (i & 7))) & 1;
+        }
+    } else {
+        throw runtime_error("Unsupported conversion");
+    }
+
+    return result;
+}
+
+static std::mutex default_pool_mutex;
+static SharedTensorPool default_pool = make_shared<TensorPool>();
+
+TensorPool::TensorPool(size_t high_water, size_t max_bytes) : high_water(high_water), max_bytes(max_bytes), retained(0) {}
+
+TensorPool::~TensorPool() {
+    clear();
+}
+
+SharedTensor TensorPool::get(echolib::any_container<size_t> dimensions, DataType dtype) {
+
+    PoolKey key(vector<size_t>(dimensions->begin(), dimensions->end()), dtype);
+
+    size_t size = Tensor::get_storage_size(dtype, multiply_dimensions(key.first));
+
+    if (size == 0)
+        return make_shared<Tensor>(key.first, dtype);
+
+    uchar* data = NULL;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = buffers.find(key);
+        if (it != buffers.end()) {
+            data = it->second.free.back();
+            it->second.free.pop_back();
+            retained -= size;
+
+            if (it->second.free.empty()) {
+                usage.erase(it->second.usage);
+                buffers.erase(it);
+            } else {
+                usage.splice(usage.begin(), usage, it->second.usage);
+            }
+        }
+    }
+
+    if (!data) data = allocate_array(size);
+
+    std::weak_ptr<TensorPool> pool = shared_from_this();
+
+    return make_shared<Tensor>(key.first, dtype, data, [pool, key, data, size]() {
+        SharedTensorPool owner = pool.lock();
+        if (owner) {
+            owner->release(key, data, size);
+        } else {
+            free(data);
+        }
+    });
+
+}
+
+void TensorPool::release(const PoolKey& key, uchar* data, size_t size) {
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = buffers.find(key);
+
+    if (size > max_bytes || high_water == 0 || (it != buffers.end() && it->second.free.size() >= high_water)) {
+        free(data);
+        return;
+    }
+
+    // Recent shapes replace the ones that have not been used for the longest time
+    while (retained + size > max_bytes && !usage.empty() && usage.back() != key) {
+        evict();
+    }
+
+    if (retained + size > max_bytes) {
+        free(data);
+        return;
+    }
+
+    it = buffers.find(key);
+
+    if (it == buffers.end()) {
+        usage.push_front(key);
+        it = buffers.insert(make_pair(key, PoolEntry{vector<uchar*>(), size, usage.begin()})).first;
+    } else {
+        usage.splice(usage.begin(), usage, it->second.usage);
+    }
+
+    it->second.free.push_back(data);
+    retained += size;
+
+}
+
+void TensorPool::set_high_water(size_t buffers) {
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    high_water = buffers;
+    trim();
+
+}
+
+void TensorPool::set_max_bytes(size_t bytes) {
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    max_bytes = bytes;
+    trim();
+
+}
+
+size_t TensorPool::get_retained() const {
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return retained;
+
+}
+
+void TensorPool::clear() {
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto& entry : buffers) {
+        for (auto data : entry.second.free) free(data);
+    }
+
+    buffers.clear();
+    usage.clear();
+    retained = 0;
+
+}
+
+void TensorPool::evict() {
+
+    auto it = buffers.find(usage.back());
+
+    free(it->second.free.back());
+    it->second.free.pop_back();
+    retained -= it->second.size;
+
+    if (it->second.free.empty()) {
+        usage.pop_back();
+        buffers.erase(it);
+    }
+
+}
+
+void TensorPool::trim() {
+
+    for (auto it = buffers.begin(); it != buffers.end(); ) {
+
+        while (!it->second.free.empty() && it->second.free.size() > high_water) {
+            free(it->second.free.back());
+            it->second.free.pop_back();
+            retained -= it->second.size;
+        }
+
+        if (it->second.free.empty()) {
+            usage.erase(it->second.usage);
+            it = buffers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    while (retained > max_bytes && !usage.empty()) {
+        evict();
+    }
+
+}
+
+SharedTensorPool TensorPool::get_default() {
+
+    std::lock_guard<std::mutex> lock(default_pool_mutex);
+
+    return default_pool;
+
+}
+
+void TensorPool::set_default(SharedTensorPool pool) {
+
+    std::lock_guard<std::mutex> lock(default_pool_mutex);
+
+    default_pool = pool;
+
+}
+
 ArrayBuffer::ArrayBuffer(SharedArray array, function<void()> complete) : array(array), complete(complete) {}
 
 ArrayBuffer::~ArrayBuffer() {
@@ -243,11 +935,14 @@ size_t ArrayBuffer::get_length() const {
 }
 
 size_t ArrayBuffer::copy_data(size_t position, uchar* buffer, size_t length) const {
-    length = min(length, array->get_size() - position);
-    if (length < 1) return 0;
+    return array->copy_data(position, buffer, length);
+}
 
-    memcpy(buffer, &(array->get_data()[position]), length);
-    return length;
+const uchar* ArrayBuffer::get_span(size_t position, size_t& length) const {
+    if (position >= array->get_size() || !array->is_contiguous()) return NULL;
+
+    length = array->get_size() - position;
+    return &(array->get_data()[position]);
 }
 
 }
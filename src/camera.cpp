@@ -0,0 +1,311 @@
+#include <cstring>
+#include <string>
+
+#ifdef BUILD_OPENCV
+#include <opencv2/opencv.hpp>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define __ECHOLIB_SSSE3_DISPATCH 1
+#endif
+
+#include "debug.h"
+#include <echolib/camera.h>
+
+using namespace std;
+using namespace echolib;
+
+namespace echolib {
+
+static inline uchar clamp_byte(int value) {
+    return (uchar) (value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+static inline uchar rgb_to_gray(int r, int g, int b) {
+    return (uchar) ((77 * r + 150 * g + 29 * b + 128) >> 8);
+}
+
+// Stores a pixel in RGB, BGR or GRAY layout and returns the position of the next one
+static inline uchar* store_pixel(uchar* dst, int r, int g, int b, PixelFormat target) {
+    switch (target) {
+    case PIXEL_BGR:
+        dst[0] = (uchar) b; dst[1] = (uchar) g; dst[2] = (uchar) r;
+        return dst + 3;
+    case PIXEL_GRAY:
+        dst[0] = rgb_to_gray(r, g, b);
+        return dst + 1;
+    default:
+        dst[0] = (uchar) r; dst[1] = (uchar) g; dst[2] = (uchar) b;
+        return dst + 3;
+    }
+}
+
+// ITU-R BT.601 with limited range, as delivered by most cameras
+static inline uchar* store_yuv(uchar* dst, int y, int u, int v, PixelFormat target) {
+    int c = 298 * (y - 16) + 128;
+    int d = u - 128;
+    int e = v - 128;
+
+    if (target == PIXEL_GRAY) {
+        dst[0] = (uchar) y;
+        return dst + 1;
+    }
+
+    return store_pixel(dst, clamp_byte((c + 409 * e) >> 8), clamp_byte((c - 100 * d - 208 * e) >> 8), clamp_byte((c + 516 * d) >> 8), target);
+}
+
+static void swap_channels_scalar(const uchar* src, uchar* dst, size_t pixels) {
+    for (size_t i = 0; i < pixels; i++, src += 3, dst += 3) {
+        uchar first = src[0];
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = first;
+    }
+}
+
+#ifdef __ECHOLIB_SSSE3_DISPATCH
+
+static bool has_ssse3() {
+    static const bool supported = __builtin_cpu_supports("ssse3");
+    return supported;
+}
+
+// Converts four pixels per step with a 16 byte load and store, the last four bytes are rewritten by the next step
+__attribute__((target("ssse3")))
+static size_t swap_channels_ssse3(const uchar* src, uchar* dst, size_t pixels) {
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15);
+    size_t i = 0;
+    for (; i + 6 <= pixels; i += 4) {
+        __m128i value = _mm_loadu_si128((const __m128i*) (src + i * 3));
+        _mm_storeu_si128((__m128i*) (dst + i * 3), _mm_shuffle_epi8(value, mask));
+    }
+    return i;
+}
+
+#endif
+
+static void swap_channels(const uchar* src, uchar* dst, size_t pixels) {
+    size_t done = 0;
+#ifdef __ECHOLIB_SSSE3_DISPATCH
+    if (has_ssse3()) done = swap_channels_ssse3(src, dst, pixels);
+#endif
+    swap_channels_scalar(src + done * 3, dst + done * 3, pixels - done);
+}
+
+SharedTensor convert_image(const SharedTensor& image, PixelFormat source, PixelFormat target, SharedTensorPool pool) {
+
+    if (source == target)
+        return image;
+
+    if (target != PIXEL_RGB && target != PIXEL_BGR && target != PIXEL_GRAY)
+        throw runtime_error("Images can only be converted to RGB, BGR or GRAY");
+
+    if (image->get_type() != UINT8)
+        throw runtime_error("Only 8-bit images can be converted");
+
+    size_t height = image->ndims() > 0 ? image->shape(0) : 0;
+    size_t width = image->ndims() > 1 ? image->shape(1) : 0;
+    size_t channels = image->ndims() > 2 ? image->shape(2) : 1;
+
+    bool valid = false;
+
+    switch (source) {
+    case PIXEL_RGB:
+    case PIXEL_BGR:
+        valid = image->ndims() == 3 && channels == 3;
+        break;
+    case PIXEL_GRAY:
+        valid = (image->ndims() == 2 || image->ndims() == 3) && channels == 1;
+        break;
+    case PIXEL_YUYV:
+        valid = image->ndims() == 3 && channels == 2 && width % 2 == 0;
+        break;
+    case PIXEL_NV12:
+        valid = image->ndims() == 2 && height % 3 == 0 && width % 2 == 0;
+        height = height / 3 * 2;
+        valid = valid && height % 2 == 0;
+        break;
+    case PIXEL_BAYER_BGGR:
+    case PIXEL_BAYER_RGGB:
+    case PIXEL_BAYER_GBRG:
+    case PIXEL_BAYER_GRBG:
+        valid = image->ndims() == 2 && height % 2 == 0 && width % 2 == 0;
+        break;
+    }
+
+    if (!valid)
+        throw runtime_error(format_string("Image shape does not match pixel format %d", (int) source));
+
+    // Views are gathered first so that the loops below can assume packed rows
+    SharedTensor input = image;
+    if (!image->is_contiguous()) {
+        input = pool ? pool->get(image->dims(), UINT8) : make_shared<Tensor>(image->dims(), UINT8);
+        image->copy_data(0, input->get_data(), input->get_size());
+    }
+
+    size_t cn = (target == PIXEL_GRAY) ? 1 : 3;
+    vector<size_t> dims = (cn == 1) ? vector<size_t>{height, width} : vector<size_t>{height, width, cn};
+
+    SharedTensor output = pool ? pool->get(dims, UINT8) : make_shared<Tensor>(dims, UINT8);
+
+    const uchar* src = input->get_data();
+    uchar* dst = output->get_data();
+    size_t pixels = height * width;
+
+    switch (source) {
+    case PIXEL_RGB:
+    case PIXEL_BGR:
+        if (target == PIXEL_GRAY) {
+            size_t r = (source == PIXEL_RGB) ? 0 : 2;
+            for (size_t i = 0; i < pixels; i++, src += 3) {
+                dst[i] = rgb_to_gray(src[r], src[1], src[2 - r]);
+            }
+        } else {
+            swap_channels(src, dst, pixels);
+        }
+        break;
+    case PIXEL_GRAY:
+        for (size_t i = 0; i < pixels; i++, dst += 3) {
+            dst[0] = dst[1] = dst[2] = src[i];
+        }
+        break;
+    case PIXEL_YUYV:
+        // Two pixels share the chroma: Y0 U Y1 V
+        for (size_t i = 0; i < pixels; i += 2, src += 4) {
+            dst = store_yuv(dst, src[0], src[1], src[3], target);
+            dst = store_yuv(dst, src[2], src[1], src[3], target);
+        }
+        break;
+    case PIXEL_NV12: {
+        // A full resolution luma plane followed by interleaved chroma for every 2x2 block
+        const uchar* chroma = src + pixels;
+        for (size_t y = 0; y < height; y++) {
+            const uchar* luma = src + y * width;
+            const uchar* uv = chroma + (y / 2) * width;
+            for (size_t x = 0; x < width; x++) {
+                dst = store_yuv(dst, luma[x], uv[x & ~((size_t) 1)], uv[x | 1], target);
+            }
+        }
+        break;
+    }
+    default: {
+        // Every 2x2 block of the mosaic becomes four pixels with the same color
+        size_t ry = (source == PIXEL_BAYER_BGGR || source == PIXEL_BAYER_GBRG) ? 1 : 0;
+        size_t rx = (source == PIXEL_BAYER_BGGR || source == PIXEL_BAYER_GRBG) ? 1 : 0;
+        for (size_t y = 0; y < height; y += 2) {
+            const uchar* rows[2] = {src + y * width, src + (y + 1) * width};
+            uchar* out[2] = {dst + y * width * cn, dst + (y + 1) * width * cn};
+            for (size_t x = 0; x < width; x += 2) {
+                int r = rows[ry][x + rx];
+                int b = rows[1 - ry][x + 1 - rx];
+                int g = (rows[ry][x + 1 - rx] + rows[1 - ry][x + rx] + 1) >> 1;
+                for (int k = 0; k < 2; k++) {
+                    out[k] = store_pixel(out[k], r, g, b, target);
+                    out[k] = store_pixel(out[k], r, g, b, target);
+                }
+            }
+        }
+        break;
+    }
+    }
+
+    return output;
+
+}
+
+#ifdef __ECHOLIB_HAS_OPENCV
+
+CompressedFrame compress_frame(const Frame& frame, FrameEncoding encoding, int quality) {
+
+    // The codecs take BGR or GRAY images
+    PixelFormat format = (frame.format == PIXEL_GRAY) ? PIXEL_GRAY : PIXEL_BGR;
+    SharedTensor image = convert_image(frame.image, frame.format, format, TensorPool::get_default());
+
+    vector<int> parameters;
+    string extension;
+
+    switch (encoding) {
+    case ENCODING_JPEG:
+        extension = ".jpg";
+        parameters = {cv::IMWRITE_JPEG_QUALITY, quality < 0 ? 80 : min(quality, 100)};
+        break;
+    case ENCODING_PNG:
+        extension = ".png";
+        parameters = {cv::IMWRITE_PNG_COMPRESSION, quality < 0 ? 1 : min(quality, 9)};
+        break;
+    default:
+        throw runtime_error("Unknown frame encoding");
+    }
+
+    vector<uchar> encoded;
+    if (!cv::imencode(extension, image->asMat(), encoded, parameters))
+        throw runtime_error("Unable to encode frame");
+
+    shared_ptr<BufferedMessage> data = make_shared<BufferedMessage>((int) encoded.size());
+    memcpy(data->get_buffer(), encoded.data(), encoded.size());
+
+    CompressedFrame result;
+    result.header = frame.header;
+    result.encoding = encoding;
+    result.format = format;
+    result.height = (int) image->shape(0);
+    result.width = (int) image->shape(1);
+    result.data = data;
+
+    return result;
+
+}
+
+SharedTensor decompress_frame(const CompressedFrame& frame, SharedTensorPool pool) {
+
+    if (!frame.data || frame.data->get_length() == 0)
+        throw runtime_error("Compressed frame is empty");
+
+    size_t length = frame.data->get_length();
+    size_t available = length;
+    const uchar* span = frame.data->get_span(0, available);
+
+    // Data that is split across buffers is gathered first
+    vector<uchar> gathered;
+    if (!span || available < length) {
+        gathered.resize(length);
+        frame.data->copy_data(0, gathered.data(), length);
+        span = gathered.data();
+    }
+
+    cv::Mat input(1, (int) length, CV_8UC1, (void*) span);
+
+    bool gray = frame.format == PIXEL_GRAY;
+    vector<size_t> dims = gray ? vector<size_t>{(size_t) frame.height, (size_t) frame.width} :
+        vector<size_t>{(size_t) frame.height, (size_t) frame.width, (size_t) 3};
+
+    SharedTensor image = pool ? pool->get(dims, UINT8) : make_shared<Tensor>(dims, UINT8);
+    cv::Mat target = image->asMat();
+
+    // The decoder writes into the tensor if the size matches, otherwise it allocates a new image
+    cv::imdecode(input, gray ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR, &target);
+
+    if (target.empty())
+        throw runtime_error("Unable to decode frame");
+
+    if (target.data != image->get_data())
+        image = make_shared<Tensor>(target);
+
+    return image;
+
+}
+
+#else
+
+CompressedFrame compress_frame(const Frame& frame, FrameEncoding encoding, int quality) {
+    throw runtime_error("Frame compression requires OpenCV");
+}
+
+SharedTensor decompress_frame(const CompressedFrame& frame, SharedTensorPool pool) {
+    throw runtime_error("Frame compression requires OpenCV");
+}
+
+#endif
+
+}
@@ -12,6 +12,7 @@
 #include <random>
 #include <chrono>
 #include <algorithm>
+#include <atomic>
 #include <netinet/in.h>
 
 #include "debug.h"
@@ -121,6 +122,13 @@ namespace echolib
         }
     }
 
+    static bool is_remote_socket(int fd)
+    {
+        struct sockaddr_storage address;
+        socklen_t length = sizeof(address);
+        return getsockname(fd, (struct sockaddr *)&address, &length) == 0 && address.ss_family != AF_UNIX;
+    }
+
     SharedClient connect(const string &address, const string &name, SharedIOLoop loop)
     {
 
@@ -132,13 +140,21 @@ namespace echolib
     }
 
     Client::Client(const string &name, const string &address) : fd(connect_socket(address)), writer(fd), reader(fd),
-                                                                next_request_key(0), subscriptions(), watches()
+                                                                next_request_key(0), batching(false), subscriptions(), watches(), publishing(0)
     {
 
         initialize_common();
 
         connected = true;
 
+        // Routers that do not know the command answer with an error, commands are then never batched
+        send_command(generate_command(ECHO_COMMAND_GET_FEATURES), [this](SharedDictionary, SharedDictionary response)
+                     {
+                         SYNCHRONIZED(mutex);
+                         batching = response->get<bool>("batch", false);
+                         return true;
+                     });
+
         if (!name.empty())
         {
 
@@ -147,6 +163,26 @@ namespace echolib
 
             send_command(command);
         }
+
+        // Messages on network connections are compressed with the first codec that the router also supports, the
+        // router compresses its messages as soon as it answers and this side once it gets the answer
+        vector<int> codecs = is_remote_socket(fd) ? get_stream_codecs() : vector<int>();
+
+        if (!codecs.empty())
+        {
+            string names;
+            for (int codec : codecs)
+                names += (names.empty() ? "" : ",") + get_stream_codec_name(codec);
+
+            SharedDictionary command = generate_command(ECHO_COMMAND_SET_COMPRESSION);
+            command->set<string>("codecs", names);
+
+            send_command(command, [this](SharedDictionary, SharedDictionary response)
+                         {
+                             writer.set_compression(get_stream_codec(response->get<string>("codec", "")));
+                             return true;
+                         });
+        }
     }
 
     Client::~Client()
@@ -225,6 +261,20 @@ namespace echolib
     bool Client::handle_output()
     {
 
+        flush_commands();
+
+        if (!ticks.empty())
+        {
+            // Copy first, callbacks may remove themselves
+            set<TickCallback> callbacks;
+            {
+                SYNCHRONIZED(mutex);
+                callbacks = ticks;
+            }
+            for (auto it = callbacks.begin(); it != callbacks.end(); ++it)
+                (*(*it))();
+        }
+
         bool status = writer.write_messages();
         if (!status)
         {
@@ -247,6 +297,16 @@ namespace echolib
         return writer.get_queue_size();
     }
 
+    string Client::get_compression() const
+    {
+        return get_stream_codec_name(writer.get_compression());
+    }
+
+    CompressionStatistics Client::get_compression_statistics(bool incoming) const
+    {
+        return incoming ? reader.get_compression_statistics() : writer.get_compression_statistics();
+    }
+
     bool Client::is_connected()
     {
         return connected;
@@ -270,57 +330,114 @@ namespace echolib
 
         if (channel == ECHO_CONTROL_CHANNEL)
         {
-            SharedDictionary response = Message::unpack<Dictionary>(message);
-            if (!response->contains("key"))
+            MessageReader reader(message);
+            SharedDictionary response = make_shared<Dictionary>();
+            read(reader, *response);
+
+            if (response->get<int>("code", ECHO_COMMAND_UNKNOWN) == ECHO_COMMAND_BATCH)
             {
-                if (response->get<int>("code", ECHO_COMMAND_UNKNOWN) == ECHO_COMMAND_EVENT)
+                int count = response->get<int>("count", 0);
+                for (int i = 0; i < count; i++)
                 {
-                    int channel = response->get<int>("channel", 0);
-                    if (watches.find(channel) == watches.end())
-                        return;
-                    auto callbacks = watches[channel];
-                    set<WatchCallback>::const_iterator iter;
-                    for (iter = callbacks.begin(); iter != callbacks.end(); ++iter)
-                        (*(*iter))(response);
+                    SharedDictionary item = make_shared<Dictionary>();
+                    read(reader, *item);
+                    handle_response(item);
                 }
                 return;
             }
-            int key = response->get<int>("key", -1);
-            if (requests.find(key) == requests.end())
-                return;
-            pair<SharedDictionary, function<void(SharedDictionary, SharedDictionary)>> pending = requests[key];
-            if (pending.second)
-                pending.second(pending.first, response);
-            requests.erase(key);
+
+            handle_response(response);
         }
         else
         {
-            if (subscriptions.find(channel) == subscriptions.end())
-                return;
-            auto callbacks = subscriptions[channel];
             set<DataCallback>::const_iterator iter;
 
-            for (iter = callbacks.begin(); iter != callbacks.end(); ++iter)
-                (*(*iter))(message);
+            if (subscriptions.find(channel) != subscriptions.end())
+            {
+                auto callbacks = subscriptions[channel];
+                for (iter = callbacks.begin(); iter != callbacks.end(); ++iter)
+                    (*(*iter))(message);
+            }
+
+            if (endpoints.find(channel) != endpoints.end())
+            {
+                auto callbacks = endpoints[channel];
+                for (iter = callbacks.begin(); iter != callbacks.end(); ++iter)
+                    (*(*iter))(message);
+            }
+        }
+    }
+
+    void Client::handle_response(SharedDictionary response)
+    {
+        if (!response->contains("key"))
+        {
+            if (response->get<int>("code", ECHO_COMMAND_UNKNOWN) == ECHO_COMMAND_EVENT)
+            {
+                int channel = response->get<int>("channel", 0);
+                set<WatchCallback>::const_iterator iter;
+                // Publishers are updated first so that watchers can already rely on their state
+                if (publications.find(channel) != publications.end())
+                {
+                    auto callbacks = publications[channel];
+                    for (iter = callbacks.begin(); iter != callbacks.end(); ++iter)
+                        (*(*iter))(response);
+                }
+                if (watches.find(channel) == watches.end())
+                    return;
+                auto callbacks = watches[channel];
+                for (iter = callbacks.begin(); iter != callbacks.end(); ++iter)
+                    (*(*iter))(response);
+            }
+            return;
         }
+        int key = response->get<int>("key", -1);
+        if (requests.find(key) == requests.end())
+            return;
+        pair<SharedDictionary, function<void(SharedDictionary, SharedDictionary)>> pending = requests[key];
+        if (pending.second)
+            pending.second(pending.first, response);
+        requests.erase(key);
     }
 
-    bool Client::subscribe(int channel, const DataCallback &callback)
+    static SubscriptionOptions merge_options(const SubscriptionOptions &a, const SubscriptionOptions &b)
+    {
+        // The subscription to a channel is shared by all callbacks of a client, so the least restrictive limits win
+        SubscriptionOptions merged;
+        merged.rate = (a.rate > 0 && b.rate > 0) ? max(a.rate, b.rate) : 0;
+        merged.decimation = max(1, min(a.decimation, b.decimation));
+        // Different regions cannot be served by one subscription, the whole tensor is received then
+        merged.region = (a.region == b.region) ? a.region : string();
+        return merged;
+    }
+
+    bool Client::subscribe(int channel, const DataCallback &callback, const SubscriptionOptions &options)
     {
         SYNCHRONIZED(mutex);
 
-        if (subscriptions.find(channel) == subscriptions.end())
+        bool subscribed = subscriptions.find(channel) != subscriptions.end();
+
+        SubscriptionOptions merged = subscribed ? merge_options(subscription_options[channel], options) : options;
+
+        if (!subscribed || merged != subscription_options[channel])
         {
             DEBUGMSG("Subscribing to channel %d\n", channel);
-            // Generate a subscription command message
+            // Generate a subscription command message, repeated subscription only updates the limits
             SharedDictionary command = generate_command(ECHO_COMMAND_SUBSCRIBE);
             command->set<int>("channel", channel);
+            if (merged.is_limited() || subscribed)
+            {
+                command->set<double>("rate", merged.rate);
+                command->set<int>("decimation", merged.decimation);
+                command->set<string>("region", merged.region);
+            }
             std::function<bool(SharedDictionary, SharedDictionary)> comm_callback = [](SharedDictionary x, SharedDictionary y)
             {
                 return true;
             };
             // add the subscription command to message queue
             send_command(command, comm_callback);
+            subscription_options[channel] = merged;
         }
 
         return subscriptions[channel].insert(callback).second; // Returns pair, the second value is success
@@ -358,6 +475,7 @@ namespace echolib
             // add the unsubscribe command to message queue
             send_command(command, callback);
             subscriptions.erase(channel);
+            subscription_options.erase(channel);
         }
 
         return true;
@@ -420,6 +538,131 @@ namespace echolib
         return true;
     }
 
+    bool Client::publish(int channel, const WatchCallback &callback)
+    {
+        SYNCHRONIZED(mutex);
+
+        // The router registers publishers during lookup, so there is no command to send here
+        return publications[channel].insert(callback).second;
+    }
+
+    bool Client::unpublish(int channel, const WatchCallback &callback)
+    {
+        SYNCHRONIZED(mutex);
+
+        if (publications.find(channel) == publications.end())
+            return false;
+
+        if (!publications[channel].erase(callback))
+            return false;
+
+        if (publications[channel].size() == 0)
+        {
+            publications.erase(channel);
+            unpublishing.insert(channel);
+            flush_unpublishing();
+        }
+
+        return true;
+    }
+
+    void Client::flush_unpublishing()
+    {
+        SYNCHRONIZED(mutex);
+
+        if (publishing > 0)
+            return;
+
+        for (int channel : unpublishing)
+        {
+            // A publisher that was looked up in the meantime keeps the channel
+            if (publications.find(channel) != publications.end())
+                continue;
+
+            // The router stops sending subscription events and forgets the retained message of a latched channel
+            SharedDictionary command = generate_command(ECHO_COMMAND_UNPUBLISH);
+            command->set<int>("channel", channel);
+            send_command(command);
+        }
+
+        unpublishing.clear();
+    }
+
+    bool Client::attach(int channel, const DataCallback &callback)
+    {
+        SYNCHRONIZED(mutex);
+
+        // Service endpoints receive messages without subscribing, the router addresses them directly
+        return endpoints[channel].insert(callback).second;
+    }
+
+    bool Client::detach(int channel, const DataCallback &callback)
+    {
+        SYNCHRONIZED(mutex);
+
+        if (endpoints.find(channel) == endpoints.end())
+            return false;
+
+        if (!endpoints[channel].erase(callback))
+            return false;
+
+        if (endpoints[channel].size() == 0)
+            endpoints.erase(channel);
+
+        return true;
+    }
+
+    bool Client::add_tick(const TickCallback &callback)
+    {
+        SYNCHRONIZED(mutex);
+
+        return ticks.insert(callback).second;
+    }
+
+    bool Client::remove_tick(const TickCallback &callback)
+    {
+        SYNCHRONIZED(mutex);
+
+        return ticks.erase(callback) > 0;
+    }
+
+    bool Client::add_deadline(const DeadlineCallback &callback)
+    {
+        SYNCHRONIZED(mutex);
+
+        return deadlines.insert(callback).second;
+    }
+
+    bool Client::remove_deadline(const DeadlineCallback &callback)
+    {
+        SYNCHRONIZED(mutex);
+
+        return deadlines.erase(callback) > 0;
+    }
+
+    int64_t Client::get_timeout()
+    {
+
+        set<DeadlineCallback> callbacks;
+        {
+            SYNCHRONIZED(mutex);
+            if (deadlines.empty())
+                return -1;
+            callbacks = deadlines;
+        }
+
+        int64_t timeout = -1;
+
+        for (auto it = callbacks.begin(); it != callbacks.end(); ++it)
+        {
+            int64_t deadline = (*(*it))();
+            if (deadline >= 0 && (timeout < 0 || deadline < timeout))
+                timeout = deadline;
+        }
+
+        return timeout;
+    }
+
     void Client::send(int channel, SharedMessage message, MessageCallback callback, int priority)
     {
 
@@ -449,13 +692,74 @@ namespace echolib
         send(ECHO_CONTROL_CHANNEL, Message::pack<Dictionary>(*command));
     }
 
+    void Client::queue_command(SharedDictionary command, function<bool(SharedDictionary, SharedDictionary)> callback)
+    {
+
+        SYNCHRONIZED(mutex);
+
+        int key = next_request_key++;
+        command->set<int>("key", key);
+
+        pair<SharedDictionary, function<bool(SharedDictionary, SharedDictionary)>> pending(command, callback);
+        requests[key] = pending;
+
+        // Queued commands are sent together on next output, the loop is woken up only once
+        queued_commands.push_back(command);
+        if (queued_commands.size() == 1)
+            notify_output();
+    }
+
+    void Client::flush_commands()
+    {
+
+        SYNCHRONIZED(mutex);
+
+        if (queued_commands.empty())
+            return;
+
+        if (queued_commands.size() == 1 || !batching)
+        {
+            for (auto command : queued_commands)
+                send(ECHO_CONTROL_CHANNEL, Message::pack<Dictionary>(*command));
+            queued_commands.clear();
+            return;
+        }
+
+        // Commands are grouped into batches that fit into a single message
+        vector<SharedBuffer> batch;
+        size_t length = 0;
+
+        auto flush = [&]()
+        {
+            Dictionary header;
+            header.set<int>("code", ECHO_COMMAND_BATCH);
+            header.set<int>("count", batch.size());
+            batch.insert(batch.begin(), Message::pack<Dictionary>(header));
+            send(ECHO_CONTROL_CHANNEL, make_shared<MultiBufferMessage>(batch));
+            batch.clear();
+            length = 0;
+        };
+
+        for (auto command : queued_commands)
+        {
+            SharedMessage packed = Message::pack<Dictionary>(*command);
+            if (!batch.empty() && length + packed->get_length() > MESSAGE_MAX_SIZE / 4)
+                flush();
+            length += packed->get_length();
+            batch.push_back(packed);
+        }
+
+        flush();
+        queued_commands.clear();
+    }
+
     static bool internal_lookup_callback(SharedDictionary in, SharedDictionary out, function<void(SharedDictionary)> callback)
     {
         callback(out);
         return true;
     }
 
-    void Client::lookup_channel(const string &alias, const string &type, function<void(SharedDictionary)> callback, bool create)
+    void Client::lookup_channel(const string &alias, const string &type, function<void(SharedDictionary)> callback, bool create, int flags)
     {
 
         using namespace std::placeholders;
@@ -474,7 +778,112 @@ namespace echolib
         command->set<string>("alias", real_alias);
         command->set<string>("type", type);
         command->set<bool>("create", create);
-        this->send_command(command, bind(&internal_lookup_callback, _1, _2, callback));
+        if (flags & LOOKUP_PUBLISHER)
+            command->set<bool>("publisher", true);
+        if (flags & LOOKUP_LATCHED)
+            command->set<bool>("latched", true);
+        if (flags & LOOKUP_SERVICE)
+            command->set<bool>("service", true);
+
+        if (!(flags & LOOKUP_PUBLISHER))
+        {
+            this->queue_command(command, bind(&internal_lookup_callback, _1, _2, callback));
+            return;
+        }
+
+        publishing++;
+
+        this->queue_command(command, [this, callback](SharedDictionary sent, SharedDictionary response)
+                            {
+                                callback(response);
+                                SYNCHRONIZED(mutex);
+                                publishing--;
+                                flush_unpublishing();
+                                return true;
+                            });
+    }
+
+    void Client::lookup_and_subscribe(const string &alias, const string &type, const DataCallback &callback, const SubscriptionOptions &options,
+                                      function<void(SharedDictionary)> lookup_callback)
+    {
+
+        // Perform remapping of channels
+        string real_alias = alias;
+        if (mappings.find(alias) != mappings.end())
+        {
+            real_alias = mappings[alias];
+        }
+
+        SYNCHRONIZED(mutex);
+
+        SharedDictionary command = generate_command(ECHO_COMMAND_SUBSCRIBE_ALIAS);
+        command->set<string>("alias", real_alias);
+        command->set<string>("type", type);
+        command->set<bool>("create", true);
+        if (options.is_limited())
+        {
+            command->set<double>("rate", options.rate);
+            command->set<int>("decimation", options.decimation);
+            command->set<string>("region", options.region);
+        }
+
+        this->queue_command(command, [this, callback, options, lookup_callback](SharedDictionary sent, SharedDictionary response)
+                            {
+            if (response->get<int>("code", ECHO_COMMAND_ERROR) == ECHO_COMMAND_RESULT)
+            {
+                SYNCHRONIZED(mutex);
+
+                int channel = response->get<int>("channel", -1);
+                bool subscribed = subscriptions.find(channel) != subscriptions.end();
+
+                // The router has applied our limits, restore the merged ones if the channel is shared
+                SubscriptionOptions merged = subscribed ? merge_options(subscription_options[channel], options) : options;
+
+                if (merged != options)
+                {
+                    SharedDictionary command = generate_command(ECHO_COMMAND_SUBSCRIBE);
+                    command->set<int>("channel", channel);
+                    command->set<double>("rate", merged.rate);
+                    command->set<int>("decimation", merged.decimation);
+                    command->set<string>("region", merged.region);
+                    send_command(command);
+                }
+
+                subscription_options[channel] = merged;
+                subscriptions[channel].insert(callback);
+            }
+
+            lookup_callback(response);
+            return true; });
+    }
+
+    void Client::create_service(const string &alias, const string &type, function<void(SharedDictionary)> callback)
+    {
+
+        using namespace std::placeholders;
+
+        // Perform remapping of channels
+        string real_alias = alias;
+        if (mappings.find(alias) != mappings.end())
+        {
+            real_alias = mappings[alias];
+        }
+
+        SYNCHRONIZED(mutex);
+
+        SharedDictionary command = generate_command(ECHO_COMMAND_CREATE_SERVICE);
+        command->set<string>("alias", real_alias);
+        command->set<string>("type", type);
+        command->set<bool>("create", true);
+        this->queue_command(command, bind(&internal_lookup_callback, _1, _2, callback));
+    }
+
+    void Client::remove_service(int channel)
+    {
+
+        SharedDictionary command = generate_command(ECHO_COMMAND_REMOVE_SERVICE);
+        command->set<int>("channel", channel);
+        send_command(command);
     }
 
     void Subscriber::lookup_callback(SharedDictionary lookup)
@@ -482,12 +891,12 @@ namespace echolib
         if (lookup->contains("error"))
         {
             this->on_error(runtime_error("Unable to find channel"));
+            return;
         }
 
+        // Already subscribed by the router as part of the lookup
         this->id = lookup->get<int>("channel", -1);
 
-        subscribe();
-
         on_ready();
     }
 
@@ -559,14 +968,15 @@ namespace echolib
 
                 pending.erase(id);
 
-                shared_ptr<Message> message = make_shared<MultiBufferMessage>(chunks->cbegin(), chunks->cend());
+                SharedMessage message = chunks->get_message();
 
                 (*callback)(message);
             }
         }
     }
 
-    Subscriber::Subscriber(SharedClient client, const string &alias, const string &type, DataCallback callback, int pending_capacity) : client(client), pending_capacity(pending_capacity)
+    Subscriber::Subscriber(SharedClient client, const string &alias, const string &type, DataCallback callback, int pending_capacity,
+                           const SubscriptionOptions &options) : client(client), pending_capacity(pending_capacity), options(options)
     {
 
         using namespace std::placeholders;
@@ -575,7 +985,7 @@ namespace echolib
 
         this->callback = (callback) ? callback : create_data_callback(bind(&Subscriber::on_message, this, _1));
 
-        client->lookup_channel(alias, type, bind(&Subscriber::lookup_callback, this, _1));
+        client->lookup_and_subscribe(alias, type, internal_callback, options, bind(&Subscriber::lookup_callback, this, _1));
     }
 
     Subscriber::~Subscriber()
@@ -588,7 +998,7 @@ namespace echolib
     {
         if (this->id < 1)
             return false;
-        return client->subscribe(id, internal_callback);
+        return client->subscribe(id, internal_callback, options);
     }
 
     bool Subscriber::unsubscribe()
@@ -610,11 +1020,18 @@ namespace echolib
     {
     }
 
-    Subscriber::ChunkList::ChunkList(int length, int chunk_size) : vector<SharedMessage>(), chunk_size(chunk_size)
+    Subscriber::ChunkList::ChunkList(int64_t length, int chunk_size) : chunk_size(chunk_size), chunks(0), received(0)
     {
-        int chunks = (int)ceil((double)length / (double)chunk_size);
+        if (length <= 0 || chunk_size <= 0)
+            return;
+
+        void *memory = NULL;
+        if (posix_memalign(&memory, MESSAGE_PAYLOAD_ALIGNMENT, length) != 0)
+            return;
+
+        message = make_shared<BufferedMessage>((uchar *)memory, (size_t)length, true);
 
-        resize(chunks, SharedMessage());
+        chunks = (int)ceil((double)length / (double)chunk_size);
     }
 
     Subscriber::ChunkList::~ChunkList()
@@ -624,10 +1041,19 @@ namespace echolib
     bool Subscriber::ChunkList::set_chunk(int index, SharedMessage &chunk)
     {
 
-        if (index > 0 && !at(index - 1))
+        // Chunks arrive in order, a missing one invalidates the message
+        if (!message || index != received)
             return false;
 
-        (*this)[index] = chunk;
+        size_t position = (size_t)index * chunk_size;
+        size_t length = min(message->get_length() - position, (size_t)chunk_size);
+
+        if (chunk->get_length() != length)
+            return false;
+
+        chunk->copy_data(0, message->get_buffer() + position, length);
+
+        received++;
 
         return true;
     }
@@ -635,7 +1061,13 @@ namespace echolib
     bool Subscriber::ChunkList::is_complete() const
     {
 
-        return (at(size() - 1)) ? true : false;
+        return message && received == chunks;
+    }
+
+    SharedMessage Subscriber::ChunkList::get_message() const
+    {
+
+        return message;
     }
 
     void Watcher::lookup_callback(SharedDictionary lookup)
@@ -697,9 +1129,42 @@ namespace echolib
 
         id = lookup->get<int>("channel", -1);
 
+        if (id > 0)
+        {
+            subscribers = lookup->get<int>("subscribers", -1);
+            client->publish(id, subscription_handler);
+        }
+
         on_ready();
     }
 
+    void Publisher::subscription_callback(SharedDictionary event)
+    {
+        string type = event->get<string>("type", "");
+
+        if (type == "subscribe" || type == "unsubscribe" || type == "summary")
+        {
+            int count = event->get<int>("subscribers", -1);
+            subscribers = count;
+            on_subscribers(count);
+        }
+    }
+
+    void Publisher::on_subscribers(int subscribers)
+    {
+    }
+
+    bool Publisher::has_subscribers() const
+    {
+        // Unknown count (e.g. an older router) is treated as if somebody is listening
+        return subscribers != 0;
+    }
+
+    bool Publisher::is_latched() const
+    {
+        return latched;
+    }
+
     void Publisher::send_callback(const SharedMessage, int state)
     {
 
@@ -713,18 +1178,22 @@ namespace echolib
     {
     }
 
-    Publisher::Publisher(SharedClient client, const string &alias, const string &type, int queue, size_t chunk_size) : client(client), queue(queue), chunk_size(chunk_size)
+    Publisher::Publisher(SharedClient client, const string &alias, const string &type, int queue, size_t chunk_size, bool latched) : client(client), queue(queue), latched(latched), chunk_size(chunk_size)
     {
 
         identifier_generator = std::bind(std::uniform_int_distribution<int64_t>{}, std::mt19937(std::random_device{}()));
 
         using namespace std::placeholders;
 
-        client->lookup_channel(alias, type, bind(&Publisher::lookup_callback, this, alias, _1));
+        subscription_handler = create_watch_callback(bind(&Publisher::subscription_callback, this, _1));
+
+        client->lookup_channel(alias, type, bind(&Publisher::lookup_callback, this, alias, _1), true, LOOKUP_PUBLISHER | (latched ? LOOKUP_LATCHED : 0));
     }
 
     Publisher::~Publisher()
     {
+        if (id > 0)
+            client->unpublish(id, subscription_handler);
     }
 
     int Publisher::get_channel_id()
@@ -750,12 +1219,25 @@ namespace echolib
         return send_message_internal(make_shared<BufferedMessage>(writer), id);
     }
 
+    bool Publisher::send_message(SharedMessage message)
+    {
+
+        if (id <= 0)
+            return false;
+
+        return send_message_internal(message, id);
+    }
+
     bool Publisher::send_message_internal(SharedMessage message, int channel)
     {
 
         if (queue > 0 && pending >= queue)
             return false;
 
+        // Latched messages are retained by the router for future subscribers
+        if (!latched && !has_subscribers())
+            return false;
+
         if (id <= 0)
             return false;
 
@@ -843,6 +1325,20 @@ namespace echolib
         return parent->copy_data(position + start, buffer, length);
     }
 
+    const uchar *Publisher::ProxyBuffer::get_span(size_t position, size_t &length) const
+    {
+
+        if (position >= this->length)
+            return NULL;
+
+        const uchar *data = parent->get_span(position + start, length);
+
+        if (data)
+            length = min(length, this->length - position);
+
+        return data;
+    }
+
     SubscriptionWatcher::SubscriptionWatcher(SharedClient client, const string &alias, function<void(int)> callback) : Watcher(client, alias), callback(callback), subscribers(0)
     {
     }
@@ -870,4 +1366,340 @@ namespace echolib
         return subscribers;
     }
 
+    Service::Service(SharedClient client, const string &alias, const string &type, ServiceHandler handler) : client(client), handler(handler)
+    {
+
+        using namespace std::placeholders;
+
+        internal_callback = create_data_callback(bind(&Service::request_callback, this, _1));
+
+        client->create_service(alias, type, bind(&Service::lookup_callback, this, _1));
+    }
+
+    Service::~Service()
+    {
+
+        if (id < 1)
+            return;
+
+        client->detach(id, internal_callback);
+        client->remove_service(id);
+    }
+
+    void Service::lookup_callback(SharedDictionary lookup)
+    {
+        if (lookup->contains("error"))
+        {
+            this->on_error(runtime_error(lookup->get<string>("error", "Unable to create service")));
+            return;
+        }
+
+        this->id = lookup->get<int>("channel", -1);
+
+        client->attach(id, internal_callback);
+
+        on_ready();
+    }
+
+    void Service::request_callback(SharedMessage message)
+    {
+
+        // Responses to requests that this connection makes itself arrive on the same channel
+        if (message->get_length() < sizeof(uint8_t) + sizeof(int64_t) * 2)
+            return;
+
+        MessageReader reader(message);
+
+        if (reader.read<uint8_t>() != ECHO_SERVICE_REQUEST)
+            return;
+
+        int64_t caller = reader.read_long();
+        int64_t identifier = reader.read_long();
+
+        SharedMessage request = make_shared<OffsetBufferMessage>(message, reader.get_position());
+        SharedMessage response;
+        int status = ECHO_SERVICE_OK;
+
+        try
+        {
+            response = on_request(request);
+        }
+        catch (std::exception &e)
+        {
+            DEBUGMSG("Service request failed: %s\n", e.what());
+            status = ECHO_SERVICE_ERROR;
+            response.reset();
+        }
+
+        if (response && response->get_length() + sizeof(uint8_t) + sizeof(int32_t) * 2 + sizeof(int64_t) * 2 > MESSAGE_MAX_SIZE)
+        {
+            DEBUGMSG("Service response too large (%ld bytes)\n", (int64_t)response->get_length());
+            status = ECHO_SERVICE_ERROR;
+            response.reset();
+        }
+
+        vector<SharedBuffer> buffers{PrimitiveBuffer<uint8_t>::wrap(ECHO_SERVICE_RESPONSE), PrimitiveBuffer<int64_t>::wrap(caller), PrimitiveBuffer<int64_t>::wrap(identifier), PrimitiveBuffer<int>::wrap(status)};
+
+        if (response)
+            buffers.push_back(response);
+
+        client->send(id, make_shared<MultiBufferMessage>(buffers));
+    }
+
+    SharedMessage Service::on_request(SharedMessage request)
+    {
+        if (handler)
+            return handler(request);
+
+        return SharedMessage();
+    }
+
+    void Service::on_ready()
+    {
+    }
+
+    void Service::on_error(const std::exception &error)
+    {
+    }
+
+    static std::atomic<int64_t> service_request_identifier(0);
+
+    ServiceClient::ServiceClient(SharedClient client, const string &alias, const string &type, int64_t timeout) : client(client), timeout(timeout), alive(make_shared<bool>(true))
+    {
+
+        using namespace std::placeholders;
+
+        internal_callback = create_data_callback(bind(&ServiceClient::response_callback, this, _1));
+        tick_callback = create_tick_callback(bind(&ServiceClient::tick, this));
+        deadline_callback = create_deadline_callback(bind(&ServiceClient::get_deadline, this));
+
+        client->add_tick(tick_callback);
+        client->add_deadline(deadline_callback);
+
+        client->lookup_channel(alias, type, bind(&ServiceClient::lookup_callback, this, _1), true, LOOKUP_SERVICE);
+    }
+
+    ServiceClient::~ServiceClient()
+    {
+
+        alive.reset();
+
+        client->remove_tick(tick_callback);
+        client->remove_deadline(deadline_callback);
+
+        if (id > 0)
+            client->detach(id, internal_callback);
+    }
+
+    void ServiceClient::lookup_callback(SharedDictionary lookup)
+    {
+        if (lookup->contains("error"))
+        {
+            vector<ResponseCallback> callbacks;
+
+            {
+                SYNCHRONIZED(mutex);
+
+                failed = true;
+
+                for (auto it = pending.begin(); it != pending.end(); ++it)
+                    callbacks.push_back(it->second.callback);
+
+                pending.clear();
+            }
+
+            for (auto callback : callbacks)
+            {
+                if (callback)
+                    callback(ECHO_SERVICE_UNAVAILABLE, SharedMessage());
+            }
+
+            this->on_error(runtime_error("Unable to find service"));
+            return;
+        }
+
+        int channel = lookup->get<int>("channel", -1);
+
+        client->attach(channel, internal_callback);
+
+        // Send requests that were issued before the service was known, they are sent outside of the lock since
+        // a dropped request completes immediately
+        vector<pair<int64_t, SharedMessage>> waiting;
+
+        {
+            SYNCHRONIZED(mutex);
+
+            this->id = channel;
+
+            for (auto it = pending.begin(); it != pending.end(); ++it)
+            {
+                if (it->second.request)
+                {
+                    waiting.push_back(make_pair(it->first, it->second.request));
+                    it->second.request.reset();
+                }
+            }
+        }
+
+        for (auto request : waiting)
+            dispatch(request.first, request.second);
+
+        on_ready();
+    }
+
+    bool ServiceClient::call(SharedMessage request, ResponseCallback callback, int64_t timeout)
+    {
+
+        if (!request || request->get_length() + sizeof(uint8_t) + sizeof(int32_t) + sizeof(int64_t) * 2 > MESSAGE_MAX_SIZE)
+            return false;
+
+        if (timeout < 0)
+            timeout = this->timeout;
+
+        int64_t identifier = service_request_identifier++;
+
+        PendingRequest entry;
+        entry.callback = callback;
+        entry.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+        {
+            SYNCHRONIZED(mutex);
+
+            if (failed)
+                return false;
+
+            // Until the lookup is done the request is kept and sent by the lookup callback
+            if (id < 1)
+            {
+                entry.request = request;
+                pending[identifier] = entry;
+                return true;
+            }
+
+            pending[identifier] = entry;
+        }
+
+        dispatch(identifier, request);
+
+        return true;
+    }
+
+    size_t ServiceClient::get_pending() const
+    {
+        SYNCHRONIZED(mutex);
+
+        return pending.size();
+    }
+
+    void ServiceClient::dispatch(int64_t identifier, SharedMessage request)
+    {
+        // A request that is dropped from a full queue fails immediately instead of waiting for the timeout
+        client->send(id, make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{PrimitiveBuffer<uint8_t>::wrap(ECHO_SERVICE_REQUEST), PrimitiveBuffer<int64_t>::wrap(identifier), request}),
+                     [this, identifier, alive = weak_ptr<bool>(alive)](const SharedMessage message, int state)
+                     {
+                         if (state == MESSAGE_CALLBACK_DROPPED && !alive.expired())
+                             complete(identifier, ECHO_SERVICE_DROPPED, SharedMessage());
+                     });
+    }
+
+    void ServiceClient::response_callback(SharedMessage message)
+    {
+
+        // Requests for a service that this connection provides itself arrive on the same channel
+        if (message->get_length() < sizeof(uint8_t) + sizeof(int64_t) + sizeof(int32_t))
+            return;
+
+        MessageReader reader(message);
+
+        if (reader.read<uint8_t>() != ECHO_SERVICE_RESPONSE)
+            return;
+
+        int64_t identifier = reader.read_long();
+        int status = reader.read_integer();
+
+        // Responses for other clients on the same channel are ignored
+        complete(identifier, status, make_shared<OffsetBufferMessage>(message, reader.get_position()));
+    }
+
+    void ServiceClient::complete(int64_t identifier, int status, SharedMessage response)
+    {
+        ResponseCallback callback;
+
+        {
+            SYNCHRONIZED(mutex);
+
+            auto it = pending.find(identifier);
+
+            if (it == pending.end())
+                return;
+
+            callback = it->second.callback;
+            pending.erase(it);
+        }
+
+        if (callback)
+            callback(status, response);
+    }
+
+    void ServiceClient::tick()
+    {
+
+        vector<ResponseCallback> expired;
+
+        {
+            SYNCHRONIZED(mutex);
+
+            if (pending.empty())
+                return;
+
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+            for (auto it = pending.begin(); it != pending.end();)
+            {
+                if (it->second.deadline <= now)
+                {
+                    expired.push_back(it->second.callback);
+                    it = pending.erase(it);
+                }
+                else
+                    ++it;
+            }
+        }
+
+        for (auto callback : expired)
+        {
+            if (callback)
+                callback(ECHO_SERVICE_TIMEOUT, SharedMessage());
+        }
+    }
+
+    int64_t ServiceClient::get_deadline()
+    {
+        SYNCHRONIZED(mutex);
+
+        if (pending.empty())
+            return -1;
+
+        std::chrono::steady_clock::time_point earliest = pending.begin()->second.deadline;
+
+        for (auto it = pending.begin(); it != pending.end(); ++it)
+            earliest = std::min(earliest, it->second.deadline);
+
+        std::chrono::steady_clock::duration remaining = earliest - std::chrono::steady_clock::now();
+
+        if (remaining.count() <= 0)
+            return 0;
+
+        // Rounded up, the loop would otherwise wake up just before the deadline and spin
+        return std::chrono::ceil<std::chrono::milliseconds>(remaining).count();
+    }
+
+    void ServiceClient::on_ready()
+    {
+    }
+
+    void ServiceClient::on_error(const std::exception &error)
+    {
+    }
+
 }
@@ -0,0 +1,282 @@
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "debug.h"
+#include <echolib/delta.h>
+
+using namespace std;
+using namespace echolib;
+
+namespace echolib {
+
+// Kind, sequence and the sequence of the message that a delta is applied to
+#define DELTA_PREFIX_LENGTH (sizeof(uint8_t) + sizeof(uint64_t) * 2)
+
+// Deltas larger than this fraction of the tensor are replaced by a keyframe
+#define DELTA_MAX_RATIO 0.5
+
+static_assert(DELTA_BLOCK_SIZE == 64, "Block comparison assumes 64 byte blocks");
+
+#if defined(__SSE2__)
+
+static inline bool block_equal(const uchar* a, const uchar* b) {
+    __m128i d0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) a), _mm_loadu_si128((const __m128i*) b));
+    __m128i d1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (a + 16)), _mm_loadu_si128((const __m128i*) (b + 16)));
+    __m128i d2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (a + 32)), _mm_loadu_si128((const __m128i*) (b + 32)));
+    __m128i d3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (a + 48)), _mm_loadu_si128((const __m128i*) (b + 48)));
+    __m128i d = _mm_or_si128(_mm_or_si128(d0, d1), _mm_or_si128(d2, d3));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(d, _mm_setzero_si128())) == 0xFFFF;
+}
+
+#else
+
+static inline bool block_equal(const uchar* a, const uchar* b) {
+    return memcmp(a, b, DELTA_BLOCK_SIZE) == 0;
+}
+
+#endif
+
+typedef struct DeltaRun {
+    uint32_t block;
+    uint32_t count;
+} DeltaRun;
+
+// Collects runs of consecutive blocks that differ, returns the number of changed bytes
+static size_t find_changes(const uchar* current, const uchar* previous, size_t length, vector<DeltaRun>& runs) {
+
+    size_t full = length / DELTA_BLOCK_SIZE;
+    size_t blocks = (length + DELTA_BLOCK_SIZE - 1) / DELTA_BLOCK_SIZE;
+    size_t changed = 0;
+
+    runs.clear();
+
+    for (size_t i = 0; i < blocks;) {
+
+        size_t offset = i * DELTA_BLOCK_SIZE;
+        bool equal = (i < full) ? block_equal(current + offset, previous + offset) :
+            memcmp(current + offset, previous + offset, length - offset) == 0;
+
+        if (equal) {
+            i++;
+            continue;
+        }
+
+        if (!runs.empty() && runs.back().block + runs.back().count == i) {
+            runs.back().count++;
+        } else {
+            runs.push_back(DeltaRun{(uint32_t) i, 1});
+        }
+
+        changed += min((size_t) DELTA_BLOCK_SIZE, length - offset);
+        i++;
+    }
+
+    return changed;
+}
+
+static shared_ptr<MemoryBuffer> write_prefix(uint8_t kind, uint64_t sequence, uint64_t reference) {
+
+    shared_ptr<MemoryBuffer> prefix = make_shared<MemoryBuffer>(DELTA_PREFIX_LENGTH);
+    MessageWriter writer(prefix->get_buffer(), prefix->get_length());
+    writer.write<uint8_t>(kind);
+    writer.write<uint64_t>(sequence);
+    writer.write<uint64_t>(reference);
+    return prefix;
+
+}
+
+DeltaTensorPublisher::DeltaTensorPublisher(SharedClient client, const string &alias, size_t keyframe_interval, int queue) :
+    Publisher(client, alias, DELTA_TENSOR_TYPE, queue), keyframe_interval(keyframe_interval), updates(0), keyframe(true),
+    subscribers(-1), sequence(0) {
+
+}
+
+DeltaTensorPublisher::~DeltaTensorPublisher() {
+
+}
+
+void DeltaTensorPublisher::force_keyframe() {
+
+    keyframe = true;
+
+}
+
+void DeltaTensorPublisher::on_subscribers(int subscribers) {
+
+    // A new subscriber can only start from a keyframe
+    if (subscribers < 0 || subscribers > this->subscribers)
+        keyframe = true;
+
+    this->subscribers = subscribers;
+
+}
+
+bool DeltaTensorPublisher::send(const SharedTensor &tensor) {
+
+    if (get_channel_id() <= 0 || !has_subscribers()) {
+        keyframe = true;
+        return false;
+    }
+
+    // Deltas are computed on packed data, views are gathered first
+    SharedTensor current = tensor;
+    if (!current->is_contiguous()) {
+        current = make_shared<Tensor>(tensor->dims(), tensor->get_type());
+        tensor->copy_data(0, current->get_data(), current->get_size());
+    }
+
+    size_t length = current->get_size();
+
+    bool compatible = reference && reference->get_type() == current->get_type() && reference->dims() == current->dims();
+
+    vector<DeltaRun> runs;
+    bool delta = !keyframe && compatible && keyframe_interval > 0 && updates < keyframe_interval &&
+        find_changes(current->get_data(), reference->get_data(), length, runs) <= length * DELTA_MAX_RATIO;
+
+    uint64_t previous = sequence++;
+    SharedMessage message;
+
+    if (delta) {
+
+        size_t size = sizeof(size_t) * (1 + current->ndims()) + sizeof(uint8_t) + sizeof(uint32_t) * 2;
+        for (auto run : runs) {
+            size += sizeof(uint32_t) * 2 + min((size_t) run.count * DELTA_BLOCK_SIZE, length - (size_t) run.block * DELTA_BLOCK_SIZE);
+        }
+
+        shared_ptr<MemoryBuffer> body = make_shared<MemoryBuffer>(size);
+        MessageWriter writer(body->get_buffer(), body->get_length());
+
+        writer.write<size_t>(current->ndims());
+        for (auto d : current->dims()) writer.write<size_t>(d);
+        writer.write<uint8_t>((uint8_t) current->get_type());
+        writer.write<uint32_t>(DELTA_BLOCK_SIZE);
+        writer.write<uint32_t>((uint32_t) runs.size());
+
+        for (auto run : runs) {
+            size_t offset = (size_t) run.block * DELTA_BLOCK_SIZE;
+            size_t bytes = min((size_t) run.count * DELTA_BLOCK_SIZE, length - offset);
+            writer.write<uint32_t>(run.block);
+            writer.write<uint32_t>(run.count);
+            writer.write_buffer(current->get_data() + offset, bytes);
+            // The reference follows what subscribers will reconstruct
+            memcpy(reference->get_data() + offset, current->get_data() + offset, bytes);
+        }
+
+        message = make_shared<MultiBufferMessage>(initializer_list<SharedBuffer>{write_prefix(DELTA_UPDATE, sequence, previous), body});
+
+        updates++;
+
+    } else {
+
+        if (!compatible) {
+            reference = make_shared<Tensor>(current->dims(), current->get_type());
+        }
+
+        memcpy(reference->get_data(), current->get_data(), length);
+
+        message = make_shared<MultiBufferMessage>(initializer_list<SharedBuffer>{
+            write_prefix(DELTA_KEYFRAME, sequence, sequence), pack_tensor(current, DELTA_PREFIX_LENGTH)});
+
+        updates = 0;
+        keyframe = false;
+
+    }
+
+    // Subscribers can not follow deltas after a message that was not queued
+    if (!send_message(message)) {
+        keyframe = true;
+        return false;
+    }
+
+    return true;
+
+}
+
+DeltaTensorSubscriber::DeltaTensorSubscriber(SharedClient client, const string &alias, function<void(SharedTensor)> callback) :
+    Subscriber(client, alias, DELTA_TENSOR_TYPE), callback(callback), valid(false), sequence(0) {
+
+}
+
+DeltaTensorSubscriber::~DeltaTensorSubscriber() {
+
+}
+
+void DeltaTensorSubscriber::on_message(SharedMessage message) {
+
+    try {
+
+        MessageReader reader(message, true);
+
+        uint8_t kind = reader.read<uint8_t>();
+        uint64_t current = reader.read<uint64_t>();
+        uint64_t previous = reader.read<uint64_t>();
+
+        if (kind == DELTA_KEYFRAME) {
+
+            SharedTensor key;
+            read(reader, key);
+
+            if (!state || state->get_type() != key->get_type() || state->dims() != key->dims()) {
+                state = make_shared<Tensor>(key->dims(), key->get_type());
+            }
+
+            if (state->get_size() > 0)
+                key->copy_data(0, state->get_data(), state->get_size());
+
+        } else if (kind == DELTA_UPDATE) {
+
+            // A delta that does not follow the last applied message is useless until the next keyframe
+            if (!valid || previous != sequence) {
+                valid = false;
+                return;
+            }
+
+            size_t ndims = reader.read<size_t>();
+            vector<size_t> dims;
+            for (size_t i = 0; i < ndims; i++) dims.push_back(reader.read<size_t>());
+            DataType dtype = (DataType) reader.read<uint8_t>();
+
+            size_t block_size = reader.read<uint32_t>();
+            size_t count = reader.read<uint32_t>();
+            size_t length = state->get_size();
+
+            if (state->get_type() != dtype || state->dims() != dims || block_size == 0)
+                throw ParseException();
+
+            // The buffer is invalid until the delta is applied completely
+            valid = false;
+
+            for (size_t i = 0; i < count; i++) {
+                size_t offset = (size_t) reader.read<uint32_t>() * block_size;
+                size_t blocks = reader.read<uint32_t>();
+
+                if (offset >= length)
+                    throw ParseException();
+
+                size_t bytes = min(blocks * block_size, length - offset);
+                reader.copy_data(state->get_data() + offset, bytes);
+            }
+
+        } else {
+            throw ParseException();
+        }
+
+        sequence = current;
+        valid = true;
+
+        callback(state);
+
+    } catch (echolib::ParseException &e) {
+        valid = false;
+        Subscriber::on_error(e);
+    } catch (echolib::EndOfBufferException &e) {
+        valid = false;
+        Subscriber::on_error(e);
+    }
+
+}
+
+}
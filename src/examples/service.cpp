@@ -0,0 +1,72 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#include <iostream>
+#include <string>
+#include <chrono>
+
+#include <echolib/client.h>
+#include <echolib/datatypes.h>
+
+using namespace std;
+using namespace echolib;
+
+int main(int argc, char** argv) {
+
+    if (argc < 2) {
+        cout << "Usage: " << argv[0] << " server | client [requests]" << endl;
+        return -1;
+    }
+
+    SharedClient client = echolib::connect();
+
+    if (string(argv[1]) == "server") {
+
+        TypedService<Dictionary, Dictionary> service(client, "sum", [](shared_ptr<Dictionary> request) {
+
+            Dictionary response;
+            response.set<int>("sum", request->get<int>("a", 0) + request->get<int>("b", 0));
+            return response;
+
+        });
+
+        while (echolib::wait(100)) {}
+
+    } else {
+
+        int requests = (argc > 2) ? atoi(argv[2]) : 1000;
+        int completed = 0, failed = 0;
+
+        TypedServiceClient<Dictionary, Dictionary> service(client, "sum");
+
+        auto start = std::chrono::steady_clock::now();
+
+        // All requests are in flight at once, responses are matched by the client
+        for (int i = 0; i < requests; i++) {
+
+            Dictionary request;
+            request.set<int>("a", i);
+            request.set<int>("b", i);
+
+            service.call(request, [&, i](int status, shared_ptr<Dictionary> response) {
+
+                if (status != ECHO_SERVICE_OK || response->get<int>("sum", -1) != 2 * i)
+                    failed++;
+
+                completed++;
+
+            });
+
+        }
+
+        while (completed < requests && echolib::wait(10)) {}
+
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+        cout << completed << " requests (" << failed << " failed) in " << duration.count() / 1000.0 << " ms" << endl;
+
+        return failed > 0 ? 1 : 0;
+
+    }
+
+    return 0;
+}
@@ -112,7 +112,8 @@ bool IOLoop::wait(int64_t timeout) {
     struct epoll_event *events;
     events = (epoll_event *) calloc (MAXEVENTS, sizeof(epoll_event));
 
-    bool write_done = true;
+    // Handlers may have deferred output (e.g. queued commands), send it before blocking
+    bool write_done = flush_output();
 
     auto start = std::chrono::system_clock::now();
     while (handlers.size() > 0) {
@@ -128,6 +129,11 @@ bool IOLoop::wait(int64_t timeout) {
                 break;
             if (!write_done) remaining = 1;
         }
+
+        int64_t deadline = get_timeout();
+        if (deadline >= 0 && (remaining < 0 || deadline < remaining))
+            remaining = deadline;
+
         int n = epoll_wait (efd, events, MAXEVENTS, remaining);
         for (int i = 0; i < n; i++) {
         	int fd = events[i].data.fd;
@@ -154,28 +160,50 @@ bool IOLoop::wait(int64_t timeout) {
             }
         }
 
-        write_done = true;
-        for (std::map<int, SharedIOBase>::iterator it = handlers.begin(); it != handlers.end(); it++) {
-            bool done = it->second->handle_output();
-            if (!done) {
-                struct epoll_event event;
-                event.data.fd = it->second->get_file_descriptor();
-                event.events = EPOLLOUT;
-                if (epoll_ctl (efd, EPOLL_CTL_ADD, event.data.fd, &event) == -1) {
-                    if (errno == EBADF) {
-                        DEBUGMSG("Bad file descriptor, ignoring");
-                    } else if (errno != EEXIST) {
-                        throw runtime_error(format_string("Error when adding an epoll FD %d (%d)", event.data.fd, errno));
-                    }
+        write_done = flush_output();
+
+    }
+
+    free(events);
+    return handlers.size() > 0;
+
+}
+
+// The earliest time any of the handlers has to run again, -1 if none of them has a deadline
+int64_t IOLoop::get_timeout() {
+
+    int64_t timeout = -1;
+    for (std::map<int, SharedIOBase>::iterator it = handlers.begin(); it != handlers.end(); it++) {
+        int64_t deadline = it->second->get_timeout();
+        if (deadline >= 0 && (timeout < 0 || deadline < timeout))
+            timeout = deadline;
+    }
+
+    return timeout;
+
+}
+
+bool IOLoop::flush_output() {
+
+    bool write_done = true;
+    for (std::map<int, SharedIOBase>::iterator it = handlers.begin(); it != handlers.end(); it++) {
+        bool done = it->second->handle_output();
+        if (!done) {
+            struct epoll_event event;
+            event.data.fd = it->second->get_file_descriptor();
+            event.events = EPOLLOUT;
+            if (epoll_ctl (efd, EPOLL_CTL_ADD, event.data.fd, &event) == -1) {
+                if (errno == EBADF) {
+                    DEBUGMSG("Bad file descriptor, ignoring");
+                } else if (errno != EEXIST) {
+                    throw runtime_error(format_string("Error when adding an epoll FD %d (%d)", event.data.fd, errno));
                 }
             }
-            write_done &= done;
         }
-     
+        write_done &= done;
     }
 
-    free(events);
-    return handlers.size() > 0;
+    return write_done;
 
 }
 
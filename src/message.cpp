@@ -9,6 +9,17 @@
 #include <algorithm>
 #include <malloc.h>
 #include <cmath>
+#include <ctime>
+
+#ifdef ECHOLIB_LZ4
+#include <lz4.h>
+#endif
+#ifdef ECHOLIB_ZSTD
+#include <zstd.h>
+#endif
+#ifdef ECHOLIB_ZLIB
+#include <zlib.h>
+#endif
 
 #include "debug.h"
 #include <echolib/message.h>
@@ -20,6 +31,157 @@ namespace echolib
 {
 
 #define MESSAGE_DELIMITER ((char)0x0F)
+// Starts a message that consists of the codec, the original length and the compressed data
+#define MESSAGE_COMPRESSED_DELIMITER ((char)0x0E)
+#define MESSAGE_COMPRESSED_HEADER (sizeof(uchar) + sizeof(int32_t))
+// Compressed messages have to save at least this fraction of the size, otherwise the original is sent
+#define MESSAGE_COMPRESSION_MIN_SAVING 0.1
+
+#define INTEGER_TO_ARRAY(A, I)   \
+    {                            \
+        A[0] = (I >> 24) & 0xFF; \
+        A[1] = (I >> 16) & 0xFF; \
+        A[2] = (I >> 8) & 0xFF;  \
+        A[3] = I & 0xFF;         \
+    }
+
+    static uint64_t thread_time()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    }
+
+    static bool is_codec_available(int codec)
+    {
+        switch (codec)
+        {
+#ifdef ECHOLIB_LZ4
+        case STREAM_CODEC_LZ4:
+            return true;
+#endif
+#ifdef ECHOLIB_ZSTD
+        case STREAM_CODEC_ZSTD:
+            return true;
+#endif
+#ifdef ECHOLIB_ZLIB
+        case STREAM_CODEC_ZLIB:
+            return true;
+#endif
+        default:
+            return false;
+        }
+    }
+
+    // Returns the size of the compressed data, zero if it does not fit into the destination
+    static size_t compress_block(int codec, const uchar *source, size_t length, uchar *destination, size_t capacity)
+    {
+        switch (codec)
+        {
+#ifdef ECHOLIB_LZ4
+        case STREAM_CODEC_LZ4:
+        {
+            int result = LZ4_compress_default((const char *)source, (char *)destination, (int)length, (int)capacity);
+            return result > 0 ? (size_t)result : 0;
+        }
+#endif
+#ifdef ECHOLIB_ZSTD
+        case STREAM_CODEC_ZSTD:
+        {
+            size_t result = ZSTD_compress(destination, capacity, source, length, 1);
+            return ZSTD_isError(result) ? 0 : result;
+        }
+#endif
+#ifdef ECHOLIB_ZLIB
+        case STREAM_CODEC_ZLIB:
+        {
+            uLongf result = capacity;
+            return compress2(destination, &result, source, length, Z_BEST_SPEED) == Z_OK ? (size_t)result : 0;
+        }
+#endif
+        default:
+            return 0;
+        }
+    }
+
+    // Returns true if the data was decompressed to exactly the given length
+    static bool decompress_block(int codec, const uchar *source, size_t length, uchar *destination, size_t original)
+    {
+        switch (codec)
+        {
+#ifdef ECHOLIB_LZ4
+        case STREAM_CODEC_LZ4:
+            return LZ4_decompress_safe((const char *)source, (char *)destination, (int)length, (int)original) == (int)original;
+#endif
+#ifdef ECHOLIB_ZSTD
+        case STREAM_CODEC_ZSTD:
+            return ZSTD_decompress(destination, original, source, length) == original;
+#endif
+#ifdef ECHOLIB_ZLIB
+        case STREAM_CODEC_ZLIB:
+        {
+            uLongf result = original;
+            return uncompress(destination, &result, source, length) == Z_OK && result == original;
+        }
+#endif
+        default:
+            return false;
+        }
+    }
+
+    string get_stream_codec_name(int codec)
+    {
+        switch (codec)
+        {
+        case STREAM_CODEC_LZ4:
+            return "lz4";
+        case STREAM_CODEC_ZSTD:
+            return "zstd";
+        case STREAM_CODEC_ZLIB:
+            return "zlib";
+        default:
+            return "none";
+        }
+    }
+
+    int get_stream_codec(const string &name)
+    {
+        for (int codec : {STREAM_CODEC_LZ4, STREAM_CODEC_ZSTD, STREAM_CODEC_ZLIB})
+        {
+            if (name == get_stream_codec_name(codec))
+                return is_codec_available(codec) ? codec : STREAM_CODEC_NONE;
+        }
+        return STREAM_CODEC_NONE;
+    }
+
+    vector<int> get_stream_codecs()
+    {
+        vector<int> codecs;
+
+        const char *preference = getenv("ECHOLIB_COMPRESSION");
+
+        if (!preference)
+        {
+            // Faster codecs first, the links are usually not slow enough for a better ratio to pay off
+            for (int codec : {STREAM_CODEC_LZ4, STREAM_CODEC_ZSTD, STREAM_CODEC_ZLIB})
+            {
+                if (is_codec_available(codec))
+                    codecs.push_back(codec);
+            }
+            return codecs;
+        }
+
+        stringstream names(preference);
+        string name;
+        while (getline(names, name, ','))
+        {
+            int codec = get_stream_codec(name);
+            if (codec != STREAM_CODEC_NONE && find(codecs.begin(), codecs.end(), codec) == codecs.end())
+                codecs.push_back(codec);
+        }
+
+        return codecs;
+    }
 
     class StreamWriter::BoundedQueue : public bounded_priority_queue<MessageContainer, vector<MessageContainer>,
                                                                      function<bool(MessageContainer, MessageContainer)>>
@@ -39,6 +201,11 @@ namespace echolib
         return "End of buffer";
     }
 
+    const uchar *Buffer::get_span(size_t position, size_t &length) const
+    {
+        return NULL;
+    }
+
     void Buffer::inspect_data(ostream& output) const
     {
         uchar* temp = new uchar[get_length()];
@@ -51,78 +218,29 @@ namespace echolib
     {
     }
 
-    MessageReader::MessageReader(SharedMessage message) : message(message), position(0)
-    {
-    }
-
-    int16_t MessageReader::read_short()
-    {
-
-        int16_t result = 0;
-
-        copy_data((uchar *)&result, (size_t)sizeof(int16_t));
-
-        return result;
-    }
-
-    int32_t MessageReader::read_integer()
-    {
-
-        int32_t result = 0;
-
-        copy_data((uchar *)&result, (size_t)sizeof(int32_t));
-
-        return result;
-    }
+    static bool default_aliasing = false;
 
-    bool MessageReader::read_bool()
+    MessageReader::MessageReader(SharedMessage message) : MessageReader(message, default_aliasing)
     {
-
-        char result = 0;
-
-        copy_data((uchar *)&result, (size_t)sizeof(char));
-
-        return result > 0;
     }
 
-    int64_t MessageReader::read_long()
+    MessageReader::MessageReader(SharedMessage message, bool aliasing) : message(message), position(0), aliasing(aliasing), span(NULL), span_start(0), span_end(0)
     {
-
-        int64_t result = 0;
-
-        copy_data((uchar *)&result, (size_t)sizeof(int64_t));
-
-        return result;
     }
 
-    char MessageReader::read_char()
+    bool MessageReader::is_aliasing() const
     {
-
-        char result = 0;
-
-        copy_data((uchar *)&result, (size_t)sizeof(char));
-
-        return result;
+        return aliasing;
     }
 
-    float MessageReader::read_float()
+    void MessageReader::set_default_aliasing(bool aliasing)
     {
-
-        float result = 0;
-
-        copy_data((uchar *)&result, (size_t)sizeof(float));
-
-        return result;
+        default_aliasing = aliasing;
     }
 
-    double MessageReader::read_double()
+    bool MessageReader::get_default_aliasing()
     {
-
-        double result = 0;
-
-        copy_data((uchar *)&result, (size_t)sizeof(double));
-
-        return result;
+        return default_aliasing;
     }
 
     std::string MessageReader::read_string()
@@ -181,11 +299,77 @@ namespace echolib
             throw EndOfBufferException();
         }
 
-        message->copy_data(position, buffer, length);
+        if (fetch_span() && position + length <= span_end)
+        {
+            memcpy(buffer, span + (position - span_start), length);
+        }
+        else
+        {
+            message->copy_data(position, buffer, length);
+        }
 
         position += length;
     }
 
+    const uchar *MessageReader::read_span(size_t length, size_t alignment)
+    {
+
+        if (message->get_length() - position < length)
+        {
+            throw EndOfBufferException();
+        }
+
+        if (!fetch_span() || position + length > span_end)
+            return NULL;
+
+        const uchar *data = span + (position - span_start);
+
+        if (alignment > 1 && ((uintptr_t)data) % alignment != 0)
+            return NULL;
+
+        position += length;
+
+        return data;
+    }
+
+    void MessageReader::skip(size_t length)
+    {
+
+        if (message->get_length() - position < length)
+        {
+            throw EndOfBufferException();
+        }
+
+        position += length;
+    }
+
+    bool MessageReader::fetch_span()
+    {
+
+        if (span && position >= span_start && position < span_end)
+            return true;
+
+        size_t length = 0;
+        const uchar *data = message->get_span(position, length);
+
+        if (!data || length < 1)
+        {
+            span = NULL;
+            return false;
+        }
+
+        span = data;
+        span_start = position;
+        span_end = position + length;
+
+        return true;
+    }
+
+    SharedMessage MessageReader::get_message() const
+    {
+        return message;
+    }
+
     MessageWriter::~MessageWriter()
     {
 
@@ -209,24 +393,48 @@ namespace echolib
     {
     }
 
+    void MessageWriter::grow(size_t required)
+    {
+        if (required <= data_length)
+            return;
+
+        if (!data_owned)
+            throw EndOfBufferException();
+
+        // Grow geometrically so that a sequence of small writes is amortized
+        size_t capacity = max(required, max(data_length * 2, (size_t)64));
+
+        uchar *resized = (uchar *)realloc(data, sizeof(uchar) * capacity);
+
+        if (!resized)
+            throw std::bad_alloc();
+
+        data = resized;
+        data_length = capacity;
+    }
+
+    void MessageWriter::reserve(size_t capacity)
+    {
+        if (capacity <= data_length)
+            return;
+
+        if (!data_owned)
+            throw EndOfBufferException();
+
+        uchar *resized = (uchar *)realloc(data, sizeof(uchar) * capacity);
+
+        if (!resized)
+            throw std::bad_alloc();
+
+        data = resized;
+        data_length = capacity;
+    }
+
     int MessageWriter::write_buffer(const uchar *buffer, size_t len)
     {
 
         if (len > data_length - data_position)
-        {
-            if (!data_owned)
-                throw EndOfBufferException();
-            if (!data_length)
-            {
-                data_length = len;
-                data = (uchar *)malloc(sizeof(uchar) * data_length);
-            }
-            else
-            {
-                data_length = data_position + len;
-                data = (uchar *)realloc(data, sizeof(uchar) * data_length);
-            }
-        }
+            grow(data_position + len);
 
         memcpy(&(data[data_position]), buffer, len);
 
@@ -240,20 +448,7 @@ namespace echolib
         len = min(len, reader.get_length() - reader.get_position());
 
         if (len > data_length - data_position)
-        {
-            if (!data_owned)
-                throw EndOfBufferException();
-            if (!data_length)
-            {
-                data_length = len;
-                data = (uchar *)malloc(sizeof(uchar) * data_length);
-            }
-            else
-            {
-                data_length = data_position + len;
-                data = (uchar *)realloc(data, sizeof(uchar) * data_length);
-            }
-        }
+            grow(data_position + len);
 
         reader.copy_data(&(data[data_position]), len);
 
@@ -262,6 +457,20 @@ namespace echolib
         return len;
     }
 
+    int MessageWriter::write_buffer(const Buffer &buffer)
+    {
+        size_t len = buffer.get_length();
+
+        if (len > data_length - data_position)
+            grow(data_position + len);
+
+        buffer.copy_data(0, &(data[data_position]), len);
+
+        data_position += len;
+
+        return len;
+    }
+
     int MessageWriter::write_short(int16_t value)
     {
 
@@ -338,6 +547,14 @@ namespace echolib
         return len;
     }
 
+    int DummyWriter::write_buffer(const Buffer &buffer)
+    {
+
+        data_position += buffer.get_length();
+
+        return buffer.get_length();
+    }
+
     SharedMessage MessageWriter::clone_data()
     {
 
@@ -348,8 +565,20 @@ namespace echolib
         return msg;
     }
 
+    class StreamMessage : public BufferedMessage
+    {
+    public:
+        StreamMessage(uchar *allocation, uchar *data, size_t length) : MemoryBuffer(data, length, false), BufferedMessage(data, length, false), allocation(allocation) {}
+
+        virtual ~StreamMessage() { free(allocation); }
+
+    private:
+        uchar *allocation;
+    };
+
     StreamReader::StreamReader(int fd) : fd(fd)
     {
+        allocation = NULL;
         data = NULL;
         buffer_length = 0;
         total_data_read = 0;
@@ -423,16 +652,58 @@ namespace echolib
         return total_data_read;
     }
 
+    CompressionStatistics StreamReader::get_compression_statistics() const
+    {
+        return statistics;
+    }
+
+    SharedMessage StreamReader::decompress()
+    {
+        if (data_length < MESSAGE_COMPRESSED_HEADER)
+            return SharedMessage();
+
+        int codec = data[0];
+        size_t original = ((size_t)data[1] << 24) | ((size_t)data[2] << 16) | ((size_t)data[3] << 8) | (size_t)data[4];
+
+        if (original > MESSAGE_MAX_SIZE || original == 0)
+            return SharedMessage();
+
+        void *memory = NULL;
+        if (posix_memalign(&memory, MESSAGE_PAYLOAD_ALIGNMENT, original + MESSAGE_PAYLOAD_ALIGNMENT) != 0)
+            return SharedMessage();
+
+        uchar *target = (uchar *)memory + MESSAGE_PAYLOAD_ALIGNMENT - MESSAGE_PAYLOAD_OFFSET;
+
+        uint64_t start = thread_time();
+
+        if (!decompress_block(codec, data + MESSAGE_COMPRESSED_HEADER, data_length - MESSAGE_COMPRESSED_HEADER, target, original))
+        {
+            free(memory);
+            return SharedMessage();
+        }
+
+        statistics.messages++;
+        statistics.raw_bytes += original;
+        statistics.compressed_bytes += data_length;
+        statistics.time += thread_time() - start;
+
+        return make_shared<StreamMessage>((uchar *)memory, target, original);
+    }
+
     void StreamReader::reset()
     {
         state = 0;
+        compressed = false;
         data_read_counter = 0;
         data_length = 0;
         data_current = 0;
         error = 0;
 
-        if (data)
-            free(data);
+        if (allocation)
+            free(allocation);
+
+        allocation = NULL;
+        data = NULL;
     }
 
     shared_ptr<Message> StreamReader::process_buffer()
@@ -445,8 +716,9 @@ namespace echolib
             {
             case 0:
             {
-                if (buffer[i] == MESSAGE_DELIMITER)
+                if (buffer[i] == MESSAGE_DELIMITER || buffer[i] == MESSAGE_COMPRESSED_DELIMITER)
                 {
+                    compressed = buffer[i] == MESSAGE_COMPRESSED_DELIMITER;
                     state = 1;
                 }
                 else
@@ -476,8 +748,16 @@ namespace echolib
                 }
 
                 // TODO: test if total length too high
-                // TODO: custom allocator?
-                data = (uchar *)malloc(data_length * sizeof(char));
+                {
+                    void *memory = NULL;
+                    if (posix_memalign(&memory, MESSAGE_PAYLOAD_ALIGNMENT, data_length + MESSAGE_PAYLOAD_ALIGNMENT) != 0)
+                    {
+                        error = -1;
+                        break;
+                    }
+                    allocation = (uchar *)memory;
+                    data = allocation + MESSAGE_PAYLOAD_ALIGNMENT - MESSAGE_PAYLOAD_OFFSET;
+                }
 
             } // intentional fallthrough
             case 6:
@@ -492,7 +772,7 @@ namespace echolib
                 }
                 else
                 {
-                    memcpy(&(data[data_current]), &(buffer[i]), buffer_length - i - 1);
+                    memcpy(&(data[data_current]), &(buffer[i]), buffer_length - i);
                     data_current += buffer_length - i;
                     state = 6; // Wait for more data
                     i = buffer_length;
@@ -510,9 +790,24 @@ namespace echolib
 
             if (complete)
             {
-                shared_ptr<Message> ptr(make_shared<BufferedMessage>(data, data_length, true));
+                shared_ptr<Message> ptr;
+                if (compressed)
+                {
+                    // The compressed data is released by reset
+                    ptr = decompress();
+                    if (!ptr)
+                    {
+                        error = -6; // Unable to decompress
+                        return shared_ptr<Message>();
+                    }
+                }
+                else
+                {
+                    ptr = make_shared<StreamMessage>(allocation, data, data_length);
+                    allocation = NULL;
+                    data = NULL;
+                }
                 total_data_read += data_length;
-                data = NULL;
                 buffer_position = i;
                 reset();
                 return ptr;
@@ -528,7 +823,8 @@ namespace echolib
         return (lhs.priority < rhs.priority) || (lhs.priority == rhs.priority && lhs.time < rhs.time);
     }
 
-    StreamWriter::StreamWriter(int fd, size_t size) : fd(fd), outgoing(new BoundedQueue(size, &StreamWriter::comparator)), time(0)
+    StreamWriter::StreamWriter(int fd, size_t size) : fd(fd), codec(STREAM_CODEC_NONE), threshold(STREAM_COMPRESSION_THRESHOLD),
+                                                      outgoing(new BoundedQueue(size, &StreamWriter::comparator)), time(0)
     {
 
         buffer = (uchar *)malloc(BUFFER_SIZE);
@@ -613,6 +909,7 @@ namespace echolib
                 else
                 {
                     pending.reset();
+                    payload.reset();
                 }
             }
             else
@@ -640,12 +937,83 @@ namespace echolib
         return total_data_dropped;
     }
 
-#define INTEGER_TO_ARRAY(A, I)   \
-    {                            \
-        A[0] = (I >> 24) & 0xFF; \
-        A[1] = (I >> 16) & 0xFF; \
-        A[2] = (I >> 8) & 0xFF;  \
-        A[3] = I & 0xFF;         \
+    void StreamWriter::set_compression(int codec, size_t threshold)
+    {
+        this->codec = is_codec_available(codec) ? codec : STREAM_CODEC_NONE;
+        this->threshold = max((size_t)1, threshold);
+    }
+
+    int StreamWriter::get_compression() const
+    {
+        return codec;
+    }
+
+    CompressionStatistics StreamWriter::get_compression_statistics() const
+    {
+        return statistics;
+    }
+
+    SharedMessage StreamWriter::compress(SharedMessage message)
+    {
+        size_t length = message->get_length();
+
+        // The router writes a message to every subscriber, it is compressed (or found incompressible) only once
+        shared_ptr<const Message::CompressedForm> cached = std::atomic_load(&message->compressed);
+
+        if (cached && cached->codec == codec)
+        {
+            if (!cached->data)
+            {
+                statistics.skipped++;
+                return SharedMessage();
+            }
+
+            statistics.messages++;
+            statistics.raw_bytes += length;
+            statistics.compressed_bytes += cached->data->get_length();
+
+            return cached->data;
+        }
+
+        uint64_t start = thread_time();
+
+        // Messages are usually assembled from several buffers, they are gathered first
+        size_t available = length;
+        const uchar *source = message->get_span(0, available);
+        if (!source || available < length)
+        {
+            scratch.resize(length);
+            message->copy_data(0, scratch.data(), length);
+            source = scratch.data();
+        }
+
+        size_t limit = length - (size_t)(length * MESSAGE_COMPRESSION_MIN_SAVING);
+
+        shared_ptr<MemoryBuffer> block = make_shared<BufferedMessage>((int)(limit + MESSAGE_COMPRESSED_HEADER));
+        uchar *target = block->get_buffer();
+
+        size_t size = compress_block(codec, source, length, target + MESSAGE_COMPRESSED_HEADER, limit);
+
+        statistics.time += thread_time() - start;
+
+        if (!size)
+        {
+            statistics.skipped++;
+            std::atomic_store(&message->compressed, make_shared<const Message::CompressedForm>(Message::CompressedForm{codec, SharedMessage()}));
+            return SharedMessage();
+        }
+
+        target[0] = (uchar)codec;
+        INTEGER_TO_ARRAY((&target[1]), length);
+
+        statistics.messages++;
+        statistics.raw_bytes += length;
+        statistics.compressed_bytes += size + MESSAGE_COMPRESSED_HEADER;
+
+        SharedMessage result = make_shared<OffsetBufferMessage>(block, 0, size + MESSAGE_COMPRESSED_HEADER);
+        std::atomic_store(&message->compressed, make_shared<const Message::CompressedForm>(Message::CompressedForm{codec, result}));
+
+        return result;
     }
 
     void StreamWriter::reset()
@@ -655,14 +1023,28 @@ namespace echolib
 
         // Resets internal structure with new pending message
 
-        message_length = pending.message->get_length();
+        payload = pending.message;
+
+        char delimiter = MESSAGE_DELIMITER;
+
+        if (codec != STREAM_CODEC_NONE && payload->get_length() >= threshold)
+        {
+            SharedMessage compressed = compress(payload);
+            if (compressed)
+            {
+                payload = compressed;
+                delimiter = MESSAGE_COMPRESSED_DELIMITER;
+            }
+        }
+
+        message_length = payload->get_length();
         message_position = 0;
 
         int i = 0;
 
-        buffer[i++] = MESSAGE_DELIMITER;
+        buffer[i++] = delimiter;
 
-        INTEGER_TO_ARRAY((&buffer[i]), pending.message->get_length());
+        INTEGER_TO_ARRAY((&buffer[i]), payload->get_length());
 
         i += sizeof(int32_t);
 
@@ -714,7 +1096,7 @@ namespace echolib
             if (message_position >= message_length)
                 break;
 
-            count = pending.message->copy_data(message_position, buffer, min(BUFFER_SIZE, (int)(message_length - message_position)));
+            count = payload->copy_data(message_position, buffer, min(BUFFER_SIZE, (int)(message_length - message_position)));
 
             message_position += count;
             buffer_position = 0;
@@ -800,6 +1182,15 @@ namespace echolib
         return length;
     }
 
+    const uchar *MemoryBuffer::get_span(size_t position, size_t &length) const
+    {
+        if (position >= data_length)
+            return NULL;
+
+        length = data_length - position;
+        return &data[position];
+    }
+
     uchar *MemoryBuffer::get_buffer() const
     {
         return data;
@@ -838,6 +1229,18 @@ namespace echolib
         return length;
     }
 
+    const uchar *MultiBufferMessage::get_span(size_t position, size_t &length) const
+    {
+
+        if (position >= this->length)
+            return NULL;
+
+        vector<size_t>::const_iterator it = std::upper_bound(offsets.begin(), offsets.end(), position); // Find first element that is greater than position
+        int index = (it - offsets.begin()) - 1;                                                         // Find index of previous element
+
+        return buffers[index]->get_span(position - offsets[index], length);
+    }
+
     size_t MultiBufferMessage::copy_data(size_t position, uchar *buffer, size_t length) const
     {
 
@@ -857,10 +1260,12 @@ namespace echolib
         return offset;
     }
 
-    OffsetBufferMessage::OffsetBufferMessage(const SharedBuffer buffer, size_t offset) : buffer(buffer), offset(offset)
+    OffsetBufferMessage::OffsetBufferMessage(const SharedBuffer buffer, size_t offset, size_t length) : buffer(buffer), offset(offset)
     {
         if (offset > buffer->get_length())
             throw EndOfBufferException();
+
+        this->length = min(length, buffer->get_length() - offset);
     }
 
     OffsetBufferMessage::~OffsetBufferMessage()
@@ -870,13 +1275,30 @@ namespace echolib
     size_t OffsetBufferMessage::get_length() const
     {
 
-        return buffer->get_length() - offset;
+        return length;
     }
 
     size_t OffsetBufferMessage::copy_data(size_t position, uchar *buffer, size_t length) const
     {
 
-        return this->buffer->copy_data(position + offset, buffer, length);
+        if (position >= this->length)
+            return 0;
+
+        return this->buffer->copy_data(position + offset, buffer, min(length, this->length - position));
+    }
+
+    const uchar *OffsetBufferMessage::get_span(size_t position, size_t &length) const
+    {
+
+        if (position >= this->length)
+            return NULL;
+
+        const uchar *span = this->buffer->get_span(position + offset, length);
+
+        if (span)
+            length = min(length, this->length - position);
+
+        return span;
     }
 
     static inline bool is_invalid_atribute_char(char c)
@@ -12,18 +12,36 @@
 #include <echolib/client.h>
 #include <echolib/routing.h>
 #include <echolib/array.h>
+#include <echolib/camera.h>
 
 using namespace echolib;
 namespace py = pybind11;
 
 typedef function<void(string)> MessageCallback;
 
+// Names of capsules that own the storage of numpy arrays created by the binding
+#define TENSOR_CAPSULE "echolib.Tensor"
+#define MESSAGE_CAPSULE "echolib.Message"
+
+static void release_tensor_capsule(PyObject *capsule) {
+    delete static_cast<SharedTensor*>(PyCapsule_GetPointer(capsule, TENSOR_CAPSULE));
+}
+
+static void release_message_capsule(PyObject *capsule) {
+    delete static_cast<SharedMessage*>(PyCapsule_GetPointer(capsule, MESSAGE_CAPSULE));
+}
+
 class PySubscriber : public Subscriber, public std::enable_shared_from_this<PySubscriber> {
   public:
     PySubscriber(SharedClient client, const string &alias, const string &type, function<void(SharedMessage)> callback) : Subscriber(client, alias, type), callback(callback) {
 
     }
 
+    PySubscriber(SharedClient client, const string &alias, const string &type, function<void(SharedMessage)> callback, double rate, int decimation, const string &region) :
+        Subscriber(client, alias, type, NULL, 10, SubscriptionOptions{rate, decimation, region}), callback(callback) {
+
+    }
+
     virtual void on_message(SharedMessage message) {
         py::gil_scoped_acquire gil; // acquire GIL lock
         callback(message);
@@ -84,66 +102,74 @@ public:
 
         if (!a) return false;
 
-        auto capsule = py::reinterpret_borrow<py::capsule>(a.base());
+        py::object base = a.base();
 
-        if (!capsule) {
+        if (!base || !PyCapsule_IsValid(base.ptr(), TENSOR_CAPSULE)) {
 
-            std::vector<size_t> dimensions, strides;
+            std::vector<size_t> dimensions;
+            std::vector<ssize_t> strides;
 
             for (int i = 0; i < a.ndim(); i++) {
                 dimensions.push_back(static_cast<size_t>(a.shape(i)));
             }
 
             const auto pyarray_dtype = a.dtype();
+            const ssize_t itemsize = pyarray_dtype.itemsize();
             DataType type;
-            if (pyarray_dtype.is(pybind11::dtype::of<uint8_t>())) {
-	            type = UINT8;
-            } else if (pyarray_dtype.is(pybind11::dtype::of<int8_t>())) {
-                type = INT8;
-            } else if (pyarray_dtype.is(pybind11::dtype::of<uint16_t>())) {
-	            type = UINT16;
-            } else if (pyarray_dtype.is(pybind11::dtype::of<int16_t>())) {
-                type = INT16;
-            } else if (pyarray_dtype.is(pybind11::dtype::of<uint32_t>())) {
-	            type = UINT32;
-            } else if (pyarray_dtype.is(pybind11::dtype::of<int32_t>())) {
-                type = INT32;
-            } else if (pyarray_dtype.is(pybind11::dtype::of<float>())) {
-	            type = FLOAT32;
-            } else if (pyarray_dtype.is(pybind11::dtype::of<double>())) {
-                type = FLOAT64;
-            } else {
-                return false;
-            }
-
-            bool continious = true;
-            ssize_t stride = Tensor::get_type_bytes(type);
-
-            for (ssize_t i = a.ndim() - 1; i >= 0; i--) {
-
-               // std::cout << i << ":" << stride << " " << a.strides(i) << std::endl;
-
-                if (stride != a.strides(i)) {
-                    continious = false;
+            switch (pyarray_dtype.kind()) {
+                case 'u': {
+                    if (itemsize == 1) type = UINT8;
+                    else if (itemsize == 2) type = UINT16;
+                    else if (itemsize == 4) type = UINT32;
+                    else if (itemsize == 8) type = UINT64;
+                    else return false;
                     break;
                 }
+                case 'i': {
+                    if (itemsize == 1) type = INT8;
+                    else if (itemsize == 2) type = INT16;
+                    else if (itemsize == 4) type = INT32;
+                    else if (itemsize == 8) type = INT64;
+                    else return false;
+                    break;
+                }
+                case 'f': {
+                    if (itemsize == 2) type = FLOAT16;
+                    else if (itemsize == 4) type = FLOAT32;
+                    else if (itemsize == 8) type = FLOAT64;
+                    else return false;
+                    break;
+                }
+                case 'b': {
+                    type = BOOL;
+                    break;
+                }
+                default: {
+                    // Extension types such as ml_dtypes.bfloat16
+                    if (itemsize == 2 && py::str(pyarray_dtype.attr("name")).cast<std::string>() == "bfloat16") {
+                        type = BFLOAT16;
+                        break;
+                    }
+                    return false;
+                }
+            }
 
-                stride = static_cast<ssize_t>(dimensions[i]) * stride;
-
-            } 
+            for (int i = 0; i < a.ndim(); i++) {
+                strides.push_back(static_cast<ssize_t>(a.strides(i)));
+            }
 
             py::handle reservation(a);
             reservation.inc_ref();
 
-            if (continious) {
-                value = std::make_shared<Tensor>(dimensions, type, (uchar *) a.data(), [reservation](){ reservation.dec_ref(); });
-            } else {
-                return false;
-            }
+            // Non-contiguous arrays are gathered when sent, the tensor may be released by the IO thread
+            value = std::make_shared<Tensor>(dimensions, type, (uchar *) a.data(), strides, [reservation](){
+                py::gil_scoped_acquire gil;
+                reservation.dec_ref();
+            });
             
         } else {
 
-            auto ref = static_cast<SharedTensor*>(capsule);
+            auto ref = static_cast<SharedTensor*>(PyCapsule_GetPointer(base.ptr(), TENSOR_CAPSULE));
 
             value = SharedTensor(*ref);
 
@@ -155,59 +181,42 @@ public:
     static py::handle cast(const SharedTensor &src, return_value_policy policy, py::handle parent) {
         py::gil_scoped_acquire gil;
 
-        auto v = new SharedTensor(src);
-        // TODO: add capsule name
-        auto capsule = py::capsule((void *) v, [](void *v) { 
-            delete static_cast<SharedTensor*>(v);             
-        });
+        auto capsule = py::capsule((void *) new SharedTensor(src), TENSOR_CAPSULE, &release_tensor_capsule);
 
+        // Strided tensors are exposed as numpy views
         std::vector<ssize_t> dimensions(src->ndims(), 0);
 
         for (size_t i = 0; i < src->ndims(); i++) {
             dimensions[i] = static_cast<ssize_t>(src->shape(i));
         }
 
-        py::array result;
+        py::dtype dtype;
 
         switch (src->get_type()) {
-            case UINT8: {
-                result = py::array(std::move(dimensions), {}, (uint8_t *) src->get_data(), capsule);
-                break;
-            }
-            case INT8: {
-                result = py::array(std::move(dimensions), {}, (int8_t *) src->get_data(), capsule);
-                break;
-            }
-            case UINT16: {
-                result = py::array(std::move(dimensions), {}, (uint16_t *) src->get_data(), capsule);
-                break;
-            }
-            case INT16: {
-                result = py::array(std::move(dimensions), {}, (int16_t *) src->get_data(), capsule);
-                break;
-            }
-            case UINT32: {
-                result = py::array(std::move(dimensions), {}, (uint32_t *) src->get_data(), capsule);
-                break;
-            }
-            case INT32: {
-                result = py::array(std::move(dimensions), {}, (int32_t *) src->get_data(), capsule);
-                break;
-            }
-            case FLOAT32: {
-                result = py::array(std::move(dimensions), {}, (float_t *) src->get_data(), capsule);
-                break;
-            }
-            case FLOAT64: {
-               result = py::array(std::move(dimensions), {}, (double_t *) src->get_data(), capsule);
-               break;
+            case UINT8: { dtype = py::dtype::of<uint8_t>(); break; }
+            case INT8: { dtype = py::dtype::of<int8_t>(); break; }
+            case UINT16: { dtype = py::dtype::of<uint16_t>(); break; }
+            case INT16: { dtype = py::dtype::of<int16_t>(); break; }
+            case UINT32: { dtype = py::dtype::of<uint32_t>(); break; }
+            case INT32: { dtype = py::dtype::of<int32_t>(); break; }
+            case UINT64: { dtype = py::dtype::of<uint64_t>(); break; }
+            case INT64: { dtype = py::dtype::of<int64_t>(); break; }
+            case BOOL: { dtype = py::dtype::of<bool>(); break; }
+            case FLOAT16: { dtype = py::dtype("float16"); break; }
+            case FLOAT32: { dtype = py::dtype::of<float>(); break; }
+            case FLOAT64: { dtype = py::dtype::of<double>(); break; }
+            case BFLOAT16:
+            case BIT: {
+                // Numpy has no native equivalent, these are expanded
+                return cast(src->convert(src->get_type() == BIT ? BOOL : FLOAT32), policy, parent);
             }
             default: {
-                return py::none(); 
+                return py::none();
             }
-
         }
-  
+
+        py::array result(dtype, std::move(dimensions), src->strides(), src->get_data(), capsule);
+
         result.inc_ref();
         return result;
 
@@ -219,6 +228,35 @@ public:
 }
 }
 
+// Message that references the memory of a Python object exporting the buffer protocol
+class PyBufferMessage : public BufferedMessage {
+  public:
+    PyBufferMessage(Py_buffer *view) : MemoryBuffer((uchar *) view->buf, (size_t) view->len, false),
+        BufferedMessage((uchar *) view->buf, (size_t) view->len, false), view(view) {
+
+    }
+
+    virtual ~PyBufferMessage() {
+        py::gil_scoped_acquire gil;
+        PyBuffer_Release(view);
+        delete view;
+    }
+
+    static SharedMessage wrap(py::buffer buffer) {
+        Py_buffer *view = new Py_buffer();
+        if (PyObject_GetBuffer(buffer.ptr(), view, PyBUF_C_CONTIGUOUS) != 0) {
+            delete view;
+            throw py::error_already_set();
+        }
+        return make_shared<PyBufferMessage>(view);
+    }
+
+  private:
+
+    Py_buffer *view;
+
+};
+
 class PyIOBaseObserver : public IOBaseObserver {
   public:
     using IOBaseObserver::IOBaseObserver;
@@ -296,6 +334,48 @@ std::chrono::system_clock::time_point read_timestamp(MessageReader& reader) {
 
 }
 
+// Marks arrays that alias a received message as read-only, the message may be shared with other subscribers. The data
+// that was just read is checked, arrays that were copied because the data was not aligned stay writable.
+static py::object protect_aliased(MessageReader& reader, py::object array, const uchar* data, size_t size) {
+
+    if (!reader.is_aliasing() || array.is_none() || !data || size == 0)
+        return array;
+
+    size_t length = 0;
+    const uchar* span = reader.get_message()->get_span(reader.get_position() - size, length);
+
+    if (span == data && length >= size)
+        array.attr("setflags")(py::arg("write") = false);
+
+    return array;
+
+}
+
+py::object read_buffer(MessageReader& reader, ssize_t length) {
+
+    size_t size = (length < 0) ? reader.get_length() - reader.get_position() : (size_t) length;
+
+    if (reader.is_aliasing()) {
+
+        const uchar* data = reader.read_span(size);
+
+        if (data) {
+            py::capsule capsule((void *) new SharedMessage(reader.get_message()), MESSAGE_CAPSULE, &release_message_capsule);
+            py::array_t<uint8_t> result({(ssize_t) size}, {(ssize_t) 1}, data, capsule);
+            return protect_aliased(reader, result, data, size);
+        }
+
+    }
+
+    py::array_t<uint8_t> result((ssize_t) size);
+
+    if (size > 0)
+        reader.copy_data(result.mutable_data(), size);
+
+    return result;
+
+}
+
 void router(string address, bool verbose = false) {
 
     SharedIOLoop loop = make_shared<IOLoop>();
@@ -331,6 +411,37 @@ PYBIND11_MODULE(pyecho, m) {
     //py::module m("pyecho", "Echo IPC library Python bindings");
     m.doc() = "Echo IPC library Python bindings";
 
+    py::enum_<DataType>(m, "DataType")
+    .value("UINT8", UINT8)
+    .value("UINT16", UINT16)
+    .value("UINT32", UINT32)
+    .value("UINT64", UINT64)
+    .value("INT8", INT8)
+    .value("INT16", INT16)
+    .value("INT32", INT32)
+    .value("INT64", INT64)
+    .value("BOOL", BOOL)
+    .value("FLOAT16", FLOAT16)
+    .value("BFLOAT16", BFLOAT16)
+    .value("FLOAT32", FLOAT32)
+    .value("FLOAT64", FLOAT64)
+    .value("BIT", BIT);
+
+    py::enum_<PixelFormat>(m, "PixelFormat")
+    .value("RGB", PIXEL_RGB)
+    .value("BGR", PIXEL_BGR)
+    .value("GRAY", PIXEL_GRAY)
+    .value("YUYV", PIXEL_YUYV)
+    .value("NV12", PIXEL_NV12)
+    .value("BAYER_BGGR", PIXEL_BAYER_BGGR)
+    .value("BAYER_RGGB", PIXEL_BAYER_RGGB)
+    .value("BAYER_GBRG", PIXEL_BAYER_GBRG)
+    .value("BAYER_GRBG", PIXEL_BAYER_GRBG);
+
+    py::enum_<FrameEncoding>(m, "FrameEncoding")
+    .value("JPEG", ENCODING_JPEG)
+    .value("PNG", ENCODING_PNG);
+
     py::class_<IOBase, PyIOBase, std::shared_ptr<IOBase> >(m, "IOBase")
     .def(py::init())
     .def("handle_input", &IOBase::handle_input, "Handle input messages")
@@ -370,6 +481,9 @@ PYBIND11_MODULE(pyecho, m) {
 
     py::class_<Subscriber, PySubscriber, std::shared_ptr<Subscriber> >(m, "Subscriber")
     .def(py::init<SharedClient, string, string, function<void(SharedMessage)> >())
+    .def(py::init<SharedClient, string, string, function<void(SharedMessage)>, double, int, string>(),
+        py::arg("client"), py::arg("alias"), py::arg("type"), py::arg("callback"), py::arg("rate"), py::arg("decimation") = 1,
+        py::arg("region") = string(""))
     .def("subscribe", [](PySubscriber &a) {
         py::gil_scoped_release gil; // release GIL lock
         return a.subscribe();
@@ -395,7 +509,8 @@ PYBIND11_MODULE(pyecho, m) {
     .def("on_output", &IOBaseObserver::on_output);
 
     py::class_<Publisher, std::shared_ptr<Publisher> >(m, "Publisher")
-    .def(py::init<SharedClient, string, string, int>(), py::arg("client"), py::arg("channel"), py::arg("type"), py::arg("queue") = (int) -1)
+    .def(py::init<SharedClient, string, string, int, size_t, bool>(), py::arg("client"), py::arg("channel"), py::arg("type"), py::arg("queue") = (int) -1,
+        py::arg("chunk_size") = (size_t) DEFAULT_CHUNK_SIZE, py::arg("latched") = false)
     .def("send", [](Publisher &p, uchar* data, int size) {
         py::gil_scoped_release gil; // release GIL lock
         return p.send_message(data, size);
@@ -403,18 +518,44 @@ PYBIND11_MODULE(pyecho, m) {
     .def("send", [](Publisher &p, MessageWriter& message) {
         py::gil_scoped_release gil; // release GIL lock
         return p.send_message(message);
-    }, "Send a writer");
+    }, "Send a writer")
+    .def("sendTensor", [](Publisher &p, const SharedTensor &tensor, std::optional<DataType> dtype) {
+        py::gil_scoped_release gil; // release GIL lock
+        SharedMessage message = Message::pack<SharedTensor>(dtype ? tensor->convert(*dtype) : tensor);
+        return p.send_message(message);
+    }, py::arg("tensor"), py::arg("dtype") = py::none(),
+    "Send an array without copying (unless converted to dtype), it must not be modified until it is sent")
+    .def("sendBuffer", [](Publisher &p, py::buffer buffer) {
+        SharedMessage message = PyBufferMessage::wrap(buffer);
+        py::gil_scoped_release gil; // release GIL lock
+        return p.send_message(message);
+    }, "Send a contiguous buffer without copying, it must not be modified until it is sent")
+    .def("hasSubscribers", &Publisher::has_subscribers, "Check if anybody is subscribed to the channel");
 
     py::class_<MemoryBuffer, std::shared_ptr<MemoryBuffer> >(m, "MemoryBuffer")
     .def("size", &MemoryBuffer::get_length, "Get message length");
 
-    py::class_<Message, std::shared_ptr<Message> >(m, "Message");
+    py::class_<Message, std::shared_ptr<Message> >(m, "Message", py::buffer_protocol())
+    .def_buffer([](Message &message) -> py::buffer_info {
+        static uchar empty = 0;
+        size_t length = message.get_length();
+        const uchar* data = (length > 0) ? message.get_span(0, length) : &empty;
+        if (!data || length < message.get_length())
+            throw py::buffer_error("Message is not stored contiguously, use readBuffer");
+        return py::buffer_info((void *) data, 1, py::format_descriptor<uint8_t>::format(), 1,
+            {(ssize_t) message.get_length()}, {(ssize_t) 1}, true);
+    })
+    .def("size", [](Message &message) { return message.get_length(); }, "Get message length");
 
     py::class_<BufferedMessage, Message, MemoryBuffer, std::shared_ptr<BufferedMessage> >(m, "BufferedMessage")
     .def(py::init<uchar*, size_t, bool>());
     
     py::class_<MessageReader>(m, "MessageReader")
     .def(py::init<SharedMessage>())
+    .def(py::init<SharedMessage, bool>(), py::arg("message"), py::arg("aliasing"))
+    .def("isAliasing", &MessageReader::is_aliasing, "Check if arrays are returned without copying")
+    .def("position", &MessageReader::get_position, "Get current position")
+    .def("length", &MessageReader::get_length, "Get message length")
     .def("readShort", &MessageReader::read_short, "Read a short")
     .def("readInt", &MessageReader::read_integer, "Read an integer")
     .def("readBool", &MessageReader::read_bool, "Read a boolean")
@@ -439,12 +580,62 @@ PYBIND11_MODULE(pyecho, m) {
     m.def("readTimestamp", &read_timestamp, "Read a timestamp from message");
     m.def("writeTimestamp", &write_timestamp, "Write a timestamp to message");
 
+    m.def("readBuffer", &read_buffer, py::arg("reader"), py::arg("length") = (ssize_t) -1, "Read raw bytes from message as an uint8 array (remaining data by default)");
+
+    m.def("writeBuffer", [](MessageWriter& writer, py::buffer buffer) {
+        SharedMessage message = PyBufferMessage::wrap(buffer);
+        writer.write_buffer(*message);
+    }, "Write raw bytes of a contiguous buffer to message");
+
     m.def("readArray", [](MessageReader& reader) { SharedArray array; read(reader, array); return array; }, "Read an array from message");
     m.def("writeArray", [](MessageWriter& writer, const SharedArray &array ) { write(writer, array); }, "Write an array to message");
 
-    m.def("readTensor", [](MessageReader& reader) { SharedTensor tensor; read(reader, tensor); return tensor; }, "Read a tensor from message");
+    m.def("readTensor", [](MessageReader& reader) {
+        SharedTensor tensor; read(reader, tensor);
+        return protect_aliased(reader, py::cast(tensor), tensor ? tensor->get_data() : NULL, tensor ? tensor->get_size() : 0);
+    }, "Read a tensor from message, it references the message and is read-only if the reader is aliasing and the data is aligned");
     m.def("writeTensor", [](MessageWriter& writer, const SharedTensor &tensor ) { write(writer, tensor); }, "Write a tensor to message");
 
+    m.def("convertImage", [](py::object image, PixelFormat source, PixelFormat target) -> py::object {
+        // The same object is returned so that read-only received images stay protected
+        if (source == target) return image;
+        SharedTensor tensor = image.cast<SharedTensor>();
+        SharedTensor result;
+        {
+            py::gil_scoped_release release;
+            result = convert_image(tensor, source, target);
+        }
+        return py::cast(result);
+    }, "Convert an 8-bit image to RGB, BGR or GRAY, returns the image itself if it already has the target format");
+
+    m.def("encodeImage", [](py::object image, PixelFormat format, FrameEncoding encoding, int quality) -> py::tuple {
+        SharedTensor tensor = image.cast<SharedTensor>();
+        CompressedFrame compressed;
+        {
+            py::gil_scoped_release release;
+            compressed = compress_frame(Frame{Header(), tensor, format}, encoding, quality);
+        }
+        string data(compressed.data->get_length(), '\0');
+        compressed.data->copy_data(0, (uchar*) &data[0], data.size());
+        return py::make_tuple(py::bytes(data), compressed.format, compressed.width, compressed.height);
+    }, py::arg("image"), py::arg("format"), py::arg("encoding") = ENCODING_JPEG, py::arg("quality") = -1,
+    "Encode an image, returns the data and the format, width and height of the decoded image");
+
+    m.def("decodeImage", [](py::buffer data, FrameEncoding encoding, PixelFormat format, int width, int height) -> py::object {
+        CompressedFrame compressed;
+        compressed.encoding = encoding;
+        compressed.format = format;
+        compressed.width = width;
+        compressed.height = height;
+        compressed.data = PyBufferMessage::wrap(data);
+        SharedTensor result;
+        {
+            py::gil_scoped_release release;
+            result = decompress_frame(compressed);
+        }
+        return py::cast(result);
+    }, "Decode an encoded image into a pooled array");
+
     m.def("router", &router, "Run a routing daemon (blocking)");
 
 }
@@ -4,10 +4,13 @@
 #include <sys/socket.h>
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
+#include <random>
 #include <sys/un.h>
 
 #include "debug.h"
 #include <echolib/routing.h>
+#include <echolib/camera.h>
 
 // https://stackoverflow.com/questions/8104904/identify-program-that-connects-to-a-unix-domain-socket
 #define MAX_RECEIVED_MESSAGES_SIZE 50000000 // 50 MB
@@ -41,15 +44,268 @@ namespace echolib
         return command;
     }
 
+    static SharedMessage wrap(int channel, SharedMessage message) {
+
+        return make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{PrimitiveBuffer<int>::wrap(channel), message});
+
+    }
+
     void send(SharedClientConnection client, int channel, SharedMessage message) {
 
-        shared_ptr<Message> wrapper = make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{PrimitiveBuffer<int>::wrap(channel), message});
+        client->send(wrap(channel, message));
+
+    }
+
+    // Returns the number of chunks announced by the first chunk of a message, zero if it cannot be parsed
+    static size_t count_chunks(SharedMessage first)
+    {
+        try
+        {
+            MessageReader reader(first);
+            reader.read_integer();
+            reader.read_long();
+            int64_t length = reader.read_long();
+            int chunk_size = reader.read_integer();
+
+            if (length < 1 || chunk_size < 1)
+                return 0;
+
+            return (size_t)((length + chunk_size - 1) / chunk_size);
+        }
+        catch (EndOfBufferException &e)
+        {
+            return 0;
+        }
+    }
+
+    typedef struct TensorRange
+    {
+        size_t start;
+        size_t end;
+        size_t step;
+    } TensorRange;
+
+    // Parses a region in the form "start:end:step,..." with one item per dimension, parts can be omitted like in numpy
+    static bool parse_region(const string &region, vector<TensorRange> &ranges)
+    {
+        ranges.clear();
+
+        std::stringstream items(region);
+        string item;
+
+        while (std::getline(items, item, ','))
+        {
+            TensorRange range{0, SIZE_MAX, 1};
+            size_t *values[] = {&range.start, &range.end, &range.step};
+
+            std::stringstream parts(item);
+            string part;
+            size_t count = 0;
+
+            while (std::getline(parts, part, ':'))
+            {
+                if (count > 2)
+                    return false;
+
+                if (!part.empty())
+                {
+                    char *end;
+                    *values[count] = strtoul(part.c_str(), &end, 10);
+                    if (*end || !isdigit(part[0]))
+                        return false;
+                }
+
+                count++;
+            }
+
+            // A single number selects one element, the dimension is kept
+            if (item.find(':') == string::npos && !item.empty())
+                range.end = range.start + 1;
+
+            if (range.step < 1)
+                return false;
+
+            ranges.push_back(range);
+        }
+
+        return !ranges.empty();
+    }
+
+    // Identifiers for messages that are chunked by the router, random like the ones that publishers generate
+    static int64_t generate_chunk_identifier()
+    {
+        static std::mt19937_64 generator(std::random_device{}());
+        return (int64_t)generator();
+    }
+
+    // Splits a message into chunks the same way as a publisher does
+    static vector<SharedMessage> split_message(SharedMessage data, int64_t identifier, size_t chunk_size)
+    {
+        size_t length = data->get_length();
+
+        if (length <= chunk_size)
+        {
+            return vector<SharedMessage>{make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{PrimitiveBuffer<int>::wrap(-1), data})};
+        }
+
+        vector<SharedMessage> chunks;
+
+        for (size_t position = 0, i = 0; position < length; position += chunk_size, i++)
+        {
+            shared_ptr<MemoryBuffer> header = make_shared<MemoryBuffer>((i == 0 ? 2 : 1) * (sizeof(int64_t) + sizeof(int32_t)));
+            MessageWriter writer(header->get_buffer(), header->get_length());
+            writer.write_integer((int)i);
+            writer.write_long(identifier);
+            if (i == 0)
+            {
+                writer.write_long(length);
+                writer.write_integer(chunk_size);
+            }
+
+            chunks.push_back(make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{
+                header, make_shared<OffsetBufferMessage>(data, position, chunk_size)}));
+        }
+
+        return chunks;
+    }
+
+    // Cuts a region from a complete tensor or camera frame message, the result is chunked again if needed. The
+    // tensor is only referenced, strided data is gathered when the message is written to the socket.
+    static vector<SharedMessage> cut_region(const vector<SharedMessage> &chunks, const string &type, const string &region)
+    {
+        vector<TensorRange> ranges;
+
+        if (chunks.empty() || !parse_region(region, ranges))
+            return chunks;
+
+        try
+        {
+            MessageReader header(chunks[0]);
+            int sequence = header.read_integer();
+            // A cut of a single chunk message can still become larger than a chunk
+            int64_t identifier = generate_chunk_identifier();
+            size_t chunk_size = DEFAULT_CHUNK_SIZE;
+
+            SharedMessage payload;
+
+            if (sequence < 0)
+            {
+                payload = make_shared<OffsetBufferMessage>(chunks[0], header.get_position());
+            }
+            else
+            {
+                identifier = header.read_long();
+                header.read_long();
+                chunk_size = header.read_integer();
+
+                vector<SharedBuffer> parts{make_shared<OffsetBufferMessage>(chunks[0], header.get_position())};
+                for (size_t i = 1; i < chunks.size(); i++)
+                    parts.push_back(make_shared<OffsetBufferMessage>(chunks[i], sizeof(int32_t) + sizeof(int64_t)));
+
+                payload = make_shared<MultiBufferMessage>(parts.begin(), parts.end());
+            }
+
+            MessageReader reader(payload, true);
+
+            if (type == get_type_identifier<Frame>())
+            {
+                Header frame;
+                read(reader, frame);
+            }
+
+            size_t prefix = reader.get_position();
+
+            SharedTensor tensor;
+            read(reader, tensor);
+
+            size_t suffix = reader.get_position();
+
+            // Subsampled and mosaic pixel formats cannot be cut at arbitrary positions
+            if (type == get_type_identifier<Frame>() && suffix < payload->get_length())
+            {
+                int format = reader.read<uint8_t>();
+                if (format != PIXEL_RGB && format != PIXEL_BGR && format != PIXEL_GRAY)
+                    return chunks;
+            }
+
+            for (size_t i = 0; i < ranges.size() && i < tensor->ndims(); i++)
+            {
+                size_t end = min(ranges[i].end, tensor->shape(i));
+                tensor = tensor->slice(i, min(ranges[i].start, end), end, ranges[i].step);
+            }
+
+            vector<SharedBuffer> parts;
+
+            if (prefix > 0)
+                parts.push_back(make_shared<OffsetBufferMessage>(payload, 0, prefix));
+
+            parts.push_back(pack_tensor(tensor, prefix));
+
+            if (suffix < payload->get_length())
+                parts.push_back(make_shared<OffsetBufferMessage>(payload, suffix));
+
+            return split_message(make_shared<MultiBufferMessage>(parts.begin(), parts.end()), identifier, chunk_size);
+        }
+        catch (EndOfBufferException &e)
+        {
+        }
+        catch (runtime_error &e)
+        {
+        }
+
+        // Messages that cannot be parsed are forwarded unchanged
+        return chunks;
+    }
+
+    SubscriberFilter::SubscriberFilter(double rate, int decimation) : decimation(max(1, decimation)), counter(0)
+    {
+        interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(rate > 0 ? 1.0 / rate : 0));
+        next = std::chrono::steady_clock::time_point();
+    }
+
+    SubscriberFilter::~SubscriberFilter()
+    {
+    }
+
+    bool SubscriberFilter::admit(SharedClientConnection publisher, int sequence, int64_t identifier)
+    {
+        // Positive sequence numbers denote continuation chunks of a message, chunks of an unknown message are dropped
+        if (sequence > 0)
+        {
+            auto decision = passing.find(publisher);
+            return decision != passing.end() && decision->second.first == identifier && decision->second.second;
+        }
+
+        bool admitted = false;
+
+        if (++counter >= decimation)
+        {
+            counter = 0;
+
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
 
-        client->send(wrapper);
+            admitted = now >= next;
 
+            if (admitted)
+            {
+                // Keep the schedule if we are only slightly late, this way jitter does not reduce the rate
+                next = (now - next < interval) ? next + interval : now + interval;
+            }
+        }
+
+        if (sequence == 0)
+            passing[publisher] = make_pair(identifier, admitted);
+
+        return admitted;
+    }
+
+    void SubscriberFilter::forget(SharedClientConnection publisher)
+    {
+        passing.erase(publisher);
     }
 
-    Channel::Channel(int identifier, SharedClientConnection owner, const string &type) : identifier(identifier), type(type), owner(owner)
+    Channel::Channel(int identifier, SharedClientConnection owner, const string &type) : identifier(identifier), type(type), owner(owner),
+                                                                                         latched(false), service(false)
     {
     }
 
@@ -77,12 +333,59 @@ namespace echolib
     {
 
         // TODO: CHECK PERMISSION !
+        int sequence = -1;
+        int64_t chunk = 0;
+
+        if ((!filters.empty() || latched || !regions.empty()) && message->get_length() >= sizeof(int32_t))
+        {
+            MessageReader reader(message);
+            sequence = reader.read_integer();
+            if (sequence >= 0 && message->get_length() >= sizeof(int32_t) + sizeof(int64_t))
+                chunk = reader.read_long();
+        }
+
+        if (latched)
+            retain(client, message, sequence);
+
+        // Region subscribers receive complete messages only, they are cut once per distinct region
+        vector<SharedMessage> complete;
+        map<string, vector<SharedMessage>> cache;
+
+        if (!regions.empty())
+            complete = assemble(client, message, sequence);
+
+        SharedMessage wrapped;
+
         std::vector<SharedClientConnection> to_remove;
         for (std::set<SharedClientConnection>::iterator it = subscribers.begin(); it != subscribers.end(); ++it)
         {
             if ((*it)->is_connected())
             {
-                send((*it), identifier, message);
+                if (!regions.empty() && regions.count(*it))
+                {
+                    if (complete.empty())
+                        continue;
+
+                    auto filter = filters.find(*it);
+                    if (filter != filters.end() && !filter->second.admit(client, -1))
+                        continue;
+
+                    send_region(*it, complete, cache);
+                    continue;
+                }
+
+                if (!filters.empty())
+                {
+                    auto filter = filters.find(*it);
+                    if (filter != filters.end() && !filter->second.admit(client, sequence, chunk))
+                        continue;
+                }
+
+                // Subscribers share the wrapped message, so a compressed form is computed only once
+                if (!wrapped)
+                    wrapped = wrap(identifier, message);
+
+                (*it)->send(wrapped);
             }
             else
             {
@@ -100,7 +403,7 @@ namespace echolib
         return true;
     }
 
-    bool Channel::subscribe(SharedClientConnection client)
+    bool Channel::subscribe(SharedClientConnection client, bool replay)
     {
         if (!is_subscribed(client))
         {
@@ -109,14 +412,10 @@ namespace echolib
             DEBUGMSG("Client FID=%d has subscribed to channel %d (%ld total)\n",
                      client->get_file_descriptor(), get_identifier(), (int64_t)subscribers.size());
 
-            SharedDictionary status = generate_event_command(get_identifier());
-            status->set<int>("subscribers", subscribers.size());
-            status->set<string>("type", "subscribe");
-            SharedMessage message = Message::pack<Dictionary>(*status);
-            for (std::set<SharedClientConnection>::iterator it = watchers.begin(); it != watchers.end(); ++it)
-            {
-                send((*it), ECHO_CONTROL_CHANNEL, message);
-            }
+            if (replay)
+                this->replay(client);
+
+            notify("subscribe");
 
             return true;
         }
@@ -124,6 +423,70 @@ namespace echolib
         return false;
     }
 
+    void Channel::replay(SharedClientConnection client)
+    {
+        // Late joiners receive the retained message immediately, the message is shared, not copied
+        if (regions.count(client) && !retained.empty())
+        {
+            map<string, vector<SharedMessage>> cache;
+            send_region(client, retained, cache);
+            return;
+        }
+
+        for (auto it = retained.begin(); it != retained.end(); ++it)
+        {
+            send(client, identifier, *it);
+        }
+    }
+
+    void Channel::send_region(SharedClientConnection client, const vector<SharedMessage> &chunks, map<string, vector<SharedMessage>> &cache)
+    {
+        const string &region = regions[client];
+
+        auto cut = cache.find(region);
+        if (cut == cache.end())
+            cut = cache.insert(make_pair(region, cut_region(chunks, type, region))).first;
+
+        for (auto it = cut->second.begin(); it != cut->second.end(); ++it)
+        {
+            send(client, identifier, *it);
+        }
+    }
+
+    vector<SharedMessage> Channel::assemble(SharedClientConnection client, SharedMessage message, int sequence)
+    {
+        if (sequence < 0)
+        {
+            assembling.erase(client);
+            return vector<SharedMessage>{message};
+        }
+
+        vector<SharedMessage> &chunks = assembling[client];
+
+        if (sequence == 0)
+        {
+            chunks = vector<SharedMessage>{message};
+        }
+        else if (chunks.size() == (size_t)sequence)
+        {
+            chunks.push_back(message);
+        }
+        else
+        {
+            // Missing chunk, wait for the next message
+            assembling.erase(client);
+            return vector<SharedMessage>();
+        }
+
+        if (chunks.size() != count_chunks(chunks[0]))
+            return vector<SharedMessage>();
+
+        vector<SharedMessage> complete;
+        complete.swap(chunks);
+        assembling.erase(client);
+        return complete;
+    }
+
     bool Channel::unsubscribe(SharedClientConnection client)
     {
 
@@ -131,17 +494,15 @@ namespace echolib
         {
 
             subscribers.erase(client);
+            filters.erase(client);
+            regions.erase(client);
+
+            if (regions.empty())
+                assembling.clear();
             DEBUGMSG("Client FID=%d has unsubscribed from channel %d (%ld total)\n",
                      client->get_file_descriptor(), get_identifier(), (int64_t)subscribers.size());
 
-            SharedDictionary status = generate_event_command(get_identifier());
-            status->set<int>("subscribers", subscribers.size());
-            status->set<string>("type", "unsubscribe");
-            SharedMessage message = Message::pack<Dictionary>(*status);
-            for (std::set<SharedClientConnection>::iterator it = watchers.begin(); it != watchers.end(); ++it)
-            {
-                send((*it), ECHO_CONTROL_CHANNEL, message);
-            }
+            notify("unsubscribe");
 
             return true;
         }
@@ -149,6 +510,60 @@ namespace echolib
         return false;
     }
 
+    bool Channel::set_filter(SharedClientConnection client, double rate, int decimation)
+    {
+        if (!is_subscribed(client))
+            return false;
+
+        if (rate > 0 || decimation > 1)
+        {
+            DEBUGMSG("Client FID=%d limits channel %d to %.2f Hz, every %d message\n",
+                     client->get_file_descriptor(), get_identifier(), rate, decimation);
+            filters[client] = SubscriberFilter(rate, decimation);
+        }
+        else
+        {
+            filters.erase(client);
+        }
+
+        return true;
+    }
+
+    bool Channel::supports_region(const string &region) const
+    {
+        if (region.empty())
+            return true;
+
+        vector<TensorRange> ranges;
+
+        if (!parse_region(region, ranges))
+            return false;
+
+        // The type is not known until the first publisher or typed subscriber appears
+        return type.empty() || type == get_type_identifier<SharedTensor>() || type == get_type_identifier<Frame>();
+    }
+
+    bool Channel::set_region(SharedClientConnection client, const string &region)
+    {
+        if (!is_subscribed(client) || !supports_region(region))
+            return false;
+
+        if (region.empty())
+        {
+            regions.erase(client);
+
+            if (regions.empty())
+                assembling.clear();
+        }
+        else
+        {
+            DEBUGMSG("Client FID=%d receives region %s of channel %d\n", client->get_file_descriptor(), region.c_str(), get_identifier());
+            regions[client] = region;
+        }
+
+        return true;
+    }
+
     bool Channel::watch(SharedClientConnection client)
     {
         if (!is_watching(client))
@@ -183,6 +598,152 @@ namespace echolib
         return false;
     }
 
+    bool Channel::add_publisher(SharedClientConnection client)
+    {
+        return publishers.insert(client).second;
+    }
+
+    bool Channel::remove_publisher(SharedClientConnection client)
+    {
+        assembling.erase(client);
+        retaining.erase(client);
+        for (auto it = filters.begin(); it != filters.end(); ++it)
+            it->second.forget(client);
+
+        if (publishers.erase(client) == 0)
+            return false;
+
+        // The retained message is not valid without a publisher that would update it
+        if (publishers.empty())
+            set_latched(false);
+
+        return true;
+    }
+
+    void Channel::notify(const string &type)
+    {
+        SharedDictionary status = generate_event_command(get_identifier());
+        status->set<int>("subscribers", subscribers.size());
+        status->set<string>("type", type);
+        SharedMessage message = Message::pack<Dictionary>(*status);
+
+        // Publishers receive subscription changes so that they can skip packing when nobody listens
+        for (std::set<SharedClientConnection>::iterator it = publishers.begin(); it != publishers.end(); ++it)
+        {
+            send((*it), ECHO_CONTROL_CHANNEL, message);
+        }
+
+        for (std::set<SharedClientConnection>::iterator it = watchers.begin(); it != watchers.end(); ++it)
+        {
+            if (!publishers.count(*it))
+                send((*it), ECHO_CONTROL_CHANNEL, message);
+        }
+    }
+
+    bool Channel::is_latched() const
+    {
+        return latched;
+    }
+
+    void Channel::set_latched(bool l)
+    {
+        if (latched && !l)
+        {
+            retained.clear();
+            retaining.clear();
+        }
+        latched = l;
+    }
+
+    bool Channel::is_service() const
+    {
+        return service;
+    }
+
+    void Channel::set_service(bool s)
+    {
+        service = s;
+    }
+
+    SharedClientConnection Channel::get_server() const
+    {
+        return server;
+    }
+
+    bool Channel::set_server(SharedClientConnection client)
+    {
+        // Only one client can provide a service, a disconnected one is replaced
+        if (server && server != client && server->is_connected())
+            return false;
+
+        DEBUGMSG("Client FID=%d provides service on channel %d\n", client->get_file_descriptor(), get_identifier());
+
+        server = client;
+        service = true;
+        return true;
+    }
+
+    bool Channel::remove_server(SharedClientConnection client)
+    {
+        if (server != client)
+            return false;
+
+        server.reset();
+        return true;
+    }
+
+    void Channel::retain(SharedClientConnection client, SharedMessage message, int sequence)
+    {
+        if (sequence < 0)
+        {
+            // Single chunk message
+            retaining.erase(client);
+            retained = vector<SharedMessage>{message};
+            return;
+        }
+
+        vector<SharedMessage> &pending = retaining[client];
+
+        if (sequence == 0)
+        {
+            pending = vector<SharedMessage>{message};
+        }
+        else if (!pending.empty() && pending.size() == (size_t)sequence)
+        {
+            pending.push_back(message);
+        }
+        else
+        {
+            // Missing chunk, wait for the next message
+            retaining.erase(client);
+            return;
+        }
+
+        size_t chunks = count_chunks(pending[0]);
+
+        if (chunks < 1)
+        {
+            retaining.erase(client);
+            return;
+        }
+
+        if (pending.size() == chunks)
+        {
+            retained.swap(pending);
+            retaining.erase(client);
+        }
+    }
+
+    int Channel::get_subscribers() const
+    {
+        return subscribers.size();
+    }
+
+    int Channel::get_publishers() const
+    {
+        return publishers.size();
+    }
+
     bool Channel::is_subscribed(SharedClientConnection client)
     {
 
@@ -248,7 +809,8 @@ namespace echolib
 
         max_name += 2;
 
-        cout << setw(5) << "FID" << setw(max_name) << "NAME" << setw(8) << "OUT" << setw(8) << "IN" << setw(8) << "DROP" << endl;
+        cout << setw(5) << "FID" << setw(max_name) << "NAME" << setw(8) << "OUT" << setw(8) << "IN" << setw(8) << "DROP"
+             << setw(7) << "CODEC" << setw(8) << "RATIO" << setw(9) << "CPU ms" << endl;
 
         for (auto client : clients)
         {
@@ -264,6 +826,12 @@ namespace echolib
                  << setw(8) << format_bytes(stats.data_written)
                  << setw(8) << format_bytes(stats.data_dropped);
 
+            // Ratio of the compressed outgoing messages, CPU time for both directions
+            const CompressionStatistics &out = stats.compressed;
+            cout << setw(7) << get_stream_codec_name(client->get_compression())
+                 << setw(8) << fixed << setprecision(2) << (out.compressed_bytes ? (double)out.raw_bytes / out.compressed_bytes : 1.0)
+                 << setw(9) << setprecision(1) << (out.time + stats.decompressed.time) / 1000.0;
+
             cout << endl;
         }
     }
@@ -282,6 +850,8 @@ namespace echolib
         {
             ch.second->unsubscribe(client);
             ch.second->unwatch(client);
+            ch.second->remove_publisher(client);
+            ch.second->remove_server(client);
         }
 
         clients.erase(client);
@@ -306,6 +876,47 @@ namespace echolib
         {
             shared_ptr<echolib::Dictionary> command(new echolib::Dictionary);
             read(reader, *command);
+
+            if (command->get<int>("code", -1) == ECHO_COMMAND_BATCH)
+            {
+                // A batch of commands is answered with batches of responses, split so that they fit a message
+                int count = command->get<int>("count", 0);
+                vector<SharedBuffer> responses;
+                size_t length = 0;
+
+                auto flush = [&]() {
+                    if (responses.empty())
+                        return;
+                    Dictionary header;
+                    header.set<int>("code", ECHO_COMMAND_BATCH);
+                    header.set<int>("count", responses.size());
+                    responses.insert(responses.begin(), Message::pack<Dictionary>(header));
+                    send(client, ECHO_CONTROL_CHANNEL, make_shared<MultiBufferMessage>(responses));
+                    responses.clear();
+                    length = 0;
+                };
+
+                for (int i = 0; i < count; i++)
+                {
+                    shared_ptr<echolib::Dictionary> subcommand(new echolib::Dictionary);
+                    read(reader, *subcommand);
+                    // Commands other than lookups can generate events, earlier responses have to arrive before them
+                    if (subcommand->get<int>("code", -1) != ECHO_COMMAND_LOOKUP)
+                        flush();
+                    SharedDictionary response = handle_command(client, subcommand);
+                    if (!response)
+                        continue;
+                    SharedMessage packed = Message::pack<Dictionary>(*response);
+                    if (length + packed->get_length() > MESSAGE_MAX_SIZE / 2)
+                        flush();
+                    length += packed->get_length();
+                    responses.push_back(packed);
+                }
+
+                flush();
+                return;
+            }
+
             SharedDictionary response = handle_command(client, command);
             if (response)
             {
@@ -323,10 +934,64 @@ namespace echolib
 
         SharedMessage offset = make_shared<OffsetBufferMessage>(message, reader.get_position());
 
+        if (channels[channel]->is_service())
+        {
+            route_service(client, channels[channel], offset);
+            return;
+        }
+
         // Distribute the message
         channels[channel]->publish(client, offset);
     }
 
+    void Router::route_service(SharedClientConnection client, SharedChannel channel, SharedMessage message)
+    {
+        SharedClientConnection server = channel->get_server();
+
+        if (message->get_length() < sizeof(uint8_t) + sizeof(int64_t))
+            return;
+
+        MessageReader reader(message);
+        uint8_t kind = reader.read<uint8_t>();
+
+        if (kind == ECHO_SERVICE_RESPONSE)
+        {
+            // A response is prefixed with the connection identifier of the caller that gets it, only the provider responds
+            if (!server || server != client || message->get_length() < sizeof(uint8_t) + sizeof(int64_t) * 2 + sizeof(int32_t))
+                return;
+
+            int64_t caller = reader.read_long();
+
+            SharedClientConnection target = find_connection(caller);
+
+            if (!target)
+            {
+                DEBUGMSG("Caller %ld for service %d has disconnected\n", caller, channel->get_identifier());
+                return;
+            }
+
+            send(target, channel->get_identifier(), make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{PrimitiveBuffer<uint8_t>::wrap(ECHO_SERVICE_RESPONSE),
+                make_shared<OffsetBufferMessage>(message, reader.get_position())}));
+            return;
+        }
+
+        if (kind != ECHO_SERVICE_REQUEST)
+            return;
+
+        // A request starts with an identifier that the caller uses to match the response
+        if (!server || !server->is_connected())
+        {
+            int64_t id = reader.read_long();
+
+            send(client, channel->get_identifier(), make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{PrimitiveBuffer<uint8_t>::wrap(ECHO_SERVICE_RESPONSE),
+                PrimitiveBuffer<int64_t>::wrap(id), PrimitiveBuffer<int>::wrap(ECHO_SERVICE_UNAVAILABLE)}));
+            return;
+        }
+
+        send(server, channel->get_identifier(), make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{PrimitiveBuffer<uint8_t>::wrap(ECHO_SERVICE_REQUEST),
+            PrimitiveBuffer<int64_t>::wrap(client->get_identifier()), make_shared<OffsetBufferMessage>(message, reader.get_position())}));
+    }
+
     SharedChannel Router::create_channel(const string &alias, SharedClientConnection creator, const string &type)
     {
 
@@ -361,6 +1026,73 @@ namespace echolib
         return SharedClientConnection();
     }
 
+    SharedClientConnection Router::find_connection(int64_t identifier)
+    {
+
+        for (auto it = clients.begin(); it != clients.end(); it++)
+        {
+            if ((*it)->get_identifier() == identifier)
+                return *it;
+        }
+
+        return SharedClientConnection();
+    }
+
+    SharedDictionary Router::lookup_channel(SharedClientConnection client, SharedDictionary command, int key)
+    {
+        string channel_alias = command->get<string>("alias", "");
+        string channel_type = command->get<string>("type", "");
+        bool create = command->get<bool>("create", true);
+        bool publisher = command->get<bool>("publisher", false);
+        bool latched = command->get<bool>("latched", false);
+        bool service = command->get<bool>("service", false);
+        if (channel_alias.size() == 0)
+        {
+            return generate_error_command(key, "Channel argument not provided or illegal");
+        }
+
+        bool found = aliases.find(channel_alias) != aliases.end();
+
+        if (!found && !create)
+            return generate_error_command(key, "Channel does not exist");
+
+        if (create)
+        {
+            if (!found)
+            {
+                SharedChannel channel = create_channel(channel_alias, client, channel_type);
+            }
+        }
+
+        int id = aliases[channel_alias];
+
+        if (channel_type.empty() || channels[id]->get_type().empty() || channels[id]->get_type() == channel_type)
+        {
+            channels[id]->set_type(channel_type);
+            if (publisher)
+                channels[id]->add_publisher(client);
+            // Messages on a service channel are routed differently, an ordinary channel in use cannot become one
+            if (service && !channels[id]->is_service() && (channels[id]->get_publishers() > 0 || channels[id]->get_subscribers() > 0))
+                return generate_error_command(key, "Channel is not a service");
+            if (latched)
+                channels[id]->set_latched(true);
+            if (service)
+                channels[id]->set_service(true);
+            SharedDictionary command = generate_command(ECHO_COMMAND_RESULT);
+            command->set<string>("alias", channel_alias);
+            command->set<string>("type", channels[id]->get_type());
+            command->set<int>("channel", id);
+            command->set<int>("subscribers", channels[id]->get_subscribers());
+            command->set<int>("key", key);
+            return command;
+        }
+        else
+        {
+
+            return generate_error_command(key, "Channel type does not match");
+        }
+    }
+
     SharedDictionary Router::handle_command(SharedClientConnection client, SharedDictionary command)
     {
         if (!command->contains("key"))
@@ -375,82 +1107,104 @@ namespace echolib
         {
         case ECHO_COMMAND_LOOKUP:
         {
-            string channel_alias = command->get<string>("alias", "");
-            string channel_type = command->get<string>("type", "");
-            bool create = command->get<bool>("create", true);
-            if (channel_alias.size() == 0)
+            return lookup_channel(client, command, key);
+        }
+        case ECHO_COMMAND_SUBSCRIBE:
+        {
+            int channel_id = command->get<int>("channel", ECHO_COMMAND_UNKNOWN);
+
+            if (channels.find(channel_id) == channels.end())
             {
-                return generate_error_command(key, "Channel argument not provided or illegal");
+
+                return generate_error_command(key, "Channel does not exist");
             }
 
-            bool found = aliases.find(channel_alias) != aliases.end();
+            bool limited = command->contains("rate") || command->contains("decimation") || command->contains("region");
 
-            if (!found && !create)
-                return generate_error_command(key, "Channel does not exist");
+            string region = command->get<string>("region", "");
 
-            if (create)
+            if (!channels[channel_id]->supports_region(region))
             {
-                if (!found)
-                {
-                    SharedChannel channel = create_channel(channel_alias, client, channel_type);
-                }
+                return generate_error_command(key, "Region not supported");
             }
 
-            int id = aliases[channel_alias];
-
-            if (channel_type.empty() || channels[id]->get_type().empty() || channels[id]->get_type() == channel_type)
+            if (!channels[channel_id]->subscribe(client) && !limited)
             {
-                channels[id]->set_type(channel_type);
-                SharedDictionary command = generate_command(ECHO_COMMAND_RESULT);
-                command->set<string>("alias", channel_alias);
-                command->set<string>("type", channels[id]->get_type());
-                command->set<int>("channel", id);
-                command->set<int>("key", key);
-                return command;
+
+                return generate_error_command(key, "Already subscribed");
             }
-            else
-            {
 
-                return generate_error_command(key, "Channel type does not match");
+            if (limited)
+            {
+                channels[channel_id]->set_filter(client, command->get<double>("rate", 0), command->get<int>("decimation", 1));
+                channels[channel_id]->set_region(client, region);
             }
+
+            return generate_confirm_command(key);
         }
-        case ECHO_COMMAND_SUBSCRIBE:
+        case ECHO_COMMAND_SUBSCRIBE_ALIAS:
         {
-            int channel_id = command->get<int>("channel", ECHO_COMMAND_UNKNOWN);
+            // Lookup and subscribe in a single round-trip, the result is the same as for lookup
+            SharedDictionary result = lookup_channel(client, command, key);
 
-            if (channels.find(channel_id) == channels.end())
-            {
+            if (result->get<int>("code", ECHO_COMMAND_ERROR) != ECHO_COMMAND_RESULT)
+                return result;
 
-                return generate_error_command(key, "Channel does not exist");
-            }
+            int channel_id = result->get<int>("channel", ECHO_COMMAND_UNKNOWN);
 
-            if (!channels[channel_id]->subscribe(client))
-            {
+            string region = command->get<string>("region", "");
 
-                return generate_error_command(key, "Already subscribed");
-            }
+            if (!channels[channel_id]->supports_region(region))
+                return generate_error_command(key, "Region not supported");
 
-            return generate_confirm_command(key);
+            // Subscribing twice is not an error here, the filter is simply replaced
+            bool subscribed = channels[channel_id]->subscribe(client, false);
+            channels[channel_id]->set_filter(client, command->get<double>("rate", 0), command->get<int>("decimation", 1));
+            channels[channel_id]->set_region(client, region);
+
+            result->set<int>("subscribers", channels[channel_id]->get_subscribers());
+
+            // Retained messages have to follow the result, the client does not know the channel before that
+            send(client, ECHO_CONTROL_CHANNEL, Message::pack<Dictionary>(*result));
+            if (subscribed)
+                channels[channel_id]->replay(client);
+
+            return SharedDictionary();
         }
-        case ECHO_COMMAND_SUBSCRIBE_ALIAS:
+        case ECHO_COMMAND_CREATE_SERVICE:
         {
-            string channel_alias = command->get<string>("channel", "");
-            auto channel_id = aliases[channel_alias];
+            SharedDictionary result = lookup_channel(client, command, key);
+
+            if (result->get<int>("code", ECHO_COMMAND_ERROR) != ECHO_COMMAND_RESULT)
+                return result;
+
+            int channel_id = result->get<int>("channel", ECHO_COMMAND_UNKNOWN);
+
+            if (!channels[channel_id]->is_service() && (channels[channel_id]->get_publishers() > 0 || channels[channel_id]->get_subscribers() > 0))
+                return generate_error_command(key, "Channel is not a service");
+
+            if (!channels[channel_id]->set_server(client))
+                return generate_error_command(key, "Service already provided");
+
+            return result;
+        }
+        case ECHO_COMMAND_REMOVE_SERVICE:
+        {
+            int channel_id = command->get<int>("channel", 0);
+
             if (channels.find(channel_id) == channels.end())
             {
+
                 return generate_error_command(key, "Channel does not exist");
             }
 
-            if (!channels[channel_id]->subscribe(client))
+            if (!channels[channel_id]->remove_server(client))
             {
 
-                return generate_error_command(key, "Already subscribed");
+                return generate_error_command(key, "Not providing service");
             }
 
-            auto ret = generate_confirm_command(key);
-            ret->set<string>("alias", channel_alias);
-            ret->set<int>("channel_id", channel_id);
-            return ret;
+            return generate_confirm_command(key);
         }
         case ECHO_COMMAND_CREATE_CHANNEL_WITH_ALIAS:
         {
@@ -478,6 +1232,24 @@ namespace echolib
 
             return generate_confirm_command(key);
         }
+        case ECHO_COMMAND_UNPUBLISH:
+        {
+            int channel_id = command->get<int>("channel", 0);
+
+            if (channels.find(channel_id) == channels.end())
+            {
+
+                return generate_error_command(key, "Channel does not exist");
+            }
+
+            if (!channels[channel_id]->remove_publisher(client))
+            {
+
+                return generate_error_command(key, "Not publishing");
+            }
+
+            return generate_confirm_command(key);
+        }
         case ECHO_COMMAND_WATCH:
         {
 
@@ -525,6 +1297,38 @@ namespace echolib
 
             return generate_confirm_command(key);
         }
+        case ECHO_COMMAND_SET_COMPRESSION:
+        {
+            // The first codec in the order of the client that is also available here, local connections are not compressed
+            int codec = STREAM_CODEC_NONE;
+
+            if (client->is_remote())
+            {
+                vector<int> available = get_stream_codecs();
+                stringstream names(command->get<string>("codecs", ""));
+                string name;
+                while (codec == STREAM_CODEC_NONE && getline(names, name, ','))
+                {
+                    int candidate = get_stream_codec(name);
+                    if (std::find(available.begin(), available.end(), candidate) != available.end())
+                        codec = candidate;
+                }
+            }
+
+            client->set_compression(codec);
+
+            SharedDictionary result = generate_command(ECHO_COMMAND_RESULT);
+            result->set<string>("codec", get_stream_codec_name(codec));
+            result->set<int>("key", key);
+            return result;
+        }
+        case ECHO_COMMAND_GET_FEATURES:
+        {
+            SharedDictionary result = generate_command(ECHO_COMMAND_RESULT);
+            result->set<bool>("batch", true);
+            result->set<int>("key", key);
+            return result;
+        }
         case ECHO_COMMAND_GET_NAME:
         {
 
@@ -1,4 +1,5 @@
 #include <unistd.h>
+#include <atomic>
 #include <sys/socket.h>
 #include <iostream>
 #include <sys/un.h>
@@ -21,10 +22,16 @@ using namespace std;
 
 namespace echolib {
 
-ClientConnection::ClientConnection(int sfd, SharedServer server): fd(sfd), reader(sfd), writer(sfd, MAX_SEND_MESSAGE_QUEUE), connected(true),  server(server) {
+static std::atomic<int64_t> connection_identifier(1);
+
+ClientConnection::ClientConnection(int sfd, SharedServer server): fd(sfd), identifier(connection_identifier++), reader(sfd), writer(sfd, MAX_SEND_MESSAGE_QUEUE), connected(true),  server(server) {
 	struct ucred cr;
 	socklen_t len;
 
+	struct sockaddr_storage address;
+	socklen_t address_length = sizeof(address);
+	remote = getsockname(fd, (struct sockaddr *) &address, &address_length) == 0 && address.ss_family != AF_UNIX;
+
 	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cr, &len) < 0) {
 		// Unable to determine credentials, use default
 		process_id = -1;
@@ -52,6 +59,8 @@ ClientStatistics ClientConnection::get_statistics() const {
 	s.data_read = reader.get_read_data();
 	s.data_written = writer.get_written_data();
 	s.data_dropped = writer.get_dropped_data();
+	s.compressed = writer.get_compression_statistics();
+	s.decompressed = reader.get_compression_statistics();
 
 	return s;
 }
@@ -133,6 +142,18 @@ void ClientConnection::set_name(string name) {
 	this->name = name;
 }
 
+bool ClientConnection::is_remote() const {
+	return remote;
+}
+
+void ClientConnection::set_compression(int codec) {
+	writer.set_compression(codec);
+}
+
+int ClientConnection::get_compression() const {
+	return writer.get_compression();
+}
+
 bool ClientConnection::handle_input() {
 
 	while (true) {
@@ -157,6 +178,12 @@ bool ClientConnection::handle_output() {
 
 }
 
+int64_t ClientConnection::get_identifier() const {
+
+	return identifier;
+
+}
+
 bool ClientConnection::comparator(const SharedClientConnection &lhs, const SharedClientConnection &rhs) {
 
     return lhs->get_file_descriptor() < rhs->get_file_descriptor();
@@ -0,0 +1,84 @@
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <chrono>
+#include <opencv2/opencv.hpp>
+
+#include <echolib/datatypes.h>
+#include <echolib/array.h>
+#include <echolib/camera.h>
+
+using namespace std;
+using namespace echolib;
+
+// Compares the cost of encoding frames with the bytes saved on a link: test_compression [image] [link Mbit/s]
+int main(int argc, char** argv) {
+
+    cv::Mat image;
+
+    if (argc > 1 && string(argv[1]) != "synthetic") {
+        image = cv::imread(argv[1]);
+        if (image.empty()) {
+            cerr << "Cannot open image file " << argv[1] << endl;
+            return -1;
+        }
+    } else {
+        // A gradient with noise, compresses roughly like a camera image
+        image = cv::Mat(720, 1280, CV_8UC3);
+        cv::randn(image, cv::Scalar::all(0), cv::Scalar::all(8));
+        for (int y = 0; y < image.rows; y++) {
+            cv::Vec3b* row = image.ptr<cv::Vec3b>(y);
+            for (int x = 0; x < image.cols; x++) {
+                row[x] += cv::Vec3b(x * 255 / image.cols, y * 255 / image.rows, (x + y) % 256);
+            }
+        }
+    }
+
+    double link = (argc > 2) ? atof(argv[2]) : 20;
+    int iterations = 20;
+
+    Frame frame{Header("benchmark"), make_shared<Tensor>(image), PIXEL_BGR};
+
+    size_t raw = Message::pack<Frame>(frame)->get_length();
+
+    cout << "Frame " << image.cols << "x" << image.rows << ", link " << link << " Mbit/s" << endl;
+    cout << std::fixed << std::setprecision(2);
+    cout << "raw: " << raw << " bytes, " << raw * 8 / (link * 1000) << " ms transfer" << endl;
+
+    struct { FrameEncoding encoding; int quality; const char* name; } settings[] = {
+        {ENCODING_JPEG, 50, "jpeg 50"}, {ENCODING_JPEG, 80, "jpeg 80"}, {ENCODING_JPEG, 95, "jpeg 95"},
+        {ENCODING_PNG, 1, "png 1"}, {ENCODING_PNG, 6, "png 6"}
+    };
+
+    SharedTensorPool pool = make_shared<TensorPool>(2);
+
+    for (auto setting : settings) {
+
+        CompressedFrame compressed;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            compressed = compress_frame(frame, setting.encoding, setting.quality);
+        }
+        double encode = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+        // Decoded through the message path, like a subscriber
+        SharedMessage message = Message::pack<CompressedFrame>(compressed);
+        size_t bytes = message->get_length();
+
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            decompress_frame(*Message::unpack<CompressedFrame>(message), pool);
+        }
+        double decode = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+        double transfer = bytes * 8 / (link * 1000);
+
+        cout << setting.name << ": " << bytes << " bytes (" << (double) raw / bytes << "x), " << encode << " ms encode, "
+            << decode << " ms decode, " << transfer << " ms transfer, "
+            << (raw * 8 / (link * 1000)) - transfer - encode - decode << " ms saved per frame" << endl;
+
+    }
+
+    exit(0);
+}
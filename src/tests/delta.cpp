@@ -0,0 +1,232 @@
+#include <iostream>
+#include <memory>
+#include <cstring>
+
+#include <echolib/client.h>
+#include <echolib/datatypes.h>
+#include <echolib/array.h>
+#include <echolib/delta.h>
+
+using namespace std;
+using namespace echolib;
+
+// Waits until the condition holds, the loop is pumped in small steps
+static bool wait_for(function<bool()> condition, int timeout = 2000) {
+
+    for (int i = 0; i < timeout / 10; i++) {
+        if (condition()) return true;
+        echolib::wait(10);
+    }
+
+    return condition();
+
+}
+
+static bool same(const SharedTensor& a, const SharedTensor& b) {
+
+    return a && b && a->get_type() == b->get_type() && a->dims() == b->dims() &&
+        memcmp(a->get_data(), b->get_data(), a->get_size()) == 0;
+
+}
+
+static SharedTensor make_ramp(initializer_list<size_t> shape, DataType dtype) {
+
+    SharedTensor tensor = make_shared<Tensor>(shape, dtype);
+    for (size_t i = 0; i < tensor->get_size(); i++) {
+        tensor->get_data()[i] = (uchar) (i % 253);
+    }
+    return tensor;
+
+}
+
+static SharedTensor copy_tensor(const SharedTensor& tensor) {
+
+    SharedTensor copy = make_shared<Tensor>(tensor->dims(), tensor->get_type());
+    memcpy(copy->get_data(), tensor->get_data(), tensor->get_size());
+    return copy;
+
+}
+
+// Records what a delta subscriber reconstructs, the state is copied since it is updated in place
+class Receiver {
+public:
+    Receiver(SharedClient client, const string& alias) : count(0), subscriber(client, alias, [this](SharedTensor tensor) {
+        last = copy_tensor(tensor);
+        count++;
+    }) {}
+
+    SharedTensor last;
+    int count;
+
+private:
+    DeltaTensorSubscriber subscriber;
+};
+
+// Records the kind and length of every message on a delta channel
+class Inspector {
+public:
+    Inspector(SharedClient client, const string& alias) : subscriber(make_shared<Subscriber>(client, alias, DELTA_TENSOR_TYPE,
+        create_data_callback([this](SharedMessage message) {
+            MessageReader reader(message);
+            kinds.push_back(reader.read<uint8_t>());
+            lengths.push_back(message->get_length());
+        }))) {}
+
+    vector<int> kinds;
+    vector<size_t> lengths;
+
+private:
+    SharedSubscriber subscriber;
+};
+
+static SharedMessage make_raw(uint8_t kind, uint64_t sequence, uint64_t previous, SharedBuffer body) {
+
+    size_t prefix_length = sizeof(uint8_t) + sizeof(uint64_t) * 2;
+    shared_ptr<MemoryBuffer> prefix = make_shared<MemoryBuffer>(prefix_length);
+    MessageWriter writer(prefix->get_buffer(), prefix->get_length());
+    writer.write<uint8_t>(kind);
+    writer.write<uint64_t>(sequence);
+    writer.write<uint64_t>(previous);
+
+    return make_shared<MultiBufferMessage>(initializer_list<SharedBuffer>{prefix, body});
+
+}
+
+static SharedMessage make_raw_keyframe(uint64_t sequence, const SharedTensor& tensor) {
+
+    return make_raw(DELTA_KEYFRAME, sequence, sequence, pack_tensor(tensor, sizeof(uint8_t) + sizeof(uint64_t) * 2));
+
+}
+
+// A delta that replaces the first block of a one-dimensional UINT8 tensor with the given value
+static SharedMessage make_raw_delta(uint64_t sequence, uint64_t previous, size_t length, uchar value) {
+
+    shared_ptr<MemoryBuffer> body = make_shared<MemoryBuffer>(sizeof(size_t) * 2 + sizeof(uint8_t) + sizeof(uint32_t) * 4 + DELTA_BLOCK_SIZE);
+    MessageWriter writer(body->get_buffer(), body->get_length());
+    writer.write<size_t>(1);
+    writer.write<size_t>(length);
+    writer.write<uint8_t>((uint8_t) UINT8);
+    writer.write<uint32_t>(DELTA_BLOCK_SIZE);
+    writer.write<uint32_t>(1);
+    writer.write<uint32_t>(0);
+    writer.write<uint32_t>(1);
+    vector<uchar> block(DELTA_BLOCK_SIZE, value);
+    writer.write_buffer(block.data(), block.size());
+
+    return make_raw(DELTA_UPDATE, sequence, previous, body);
+
+}
+
+int main(int argc, char** argv) {
+
+    SharedClient producer = echolib::connect();
+    SharedClient consumer = echolib::connect();
+    SharedClient late = echolib::connect();
+
+    DeltaTensorPublisher publisher(producer, "delta");
+    Receiver receiver(consumer, "delta");
+    Inspector inspector(consumer, "delta");
+
+    echolib::wait(100);
+
+    // The first message is a keyframe, a small change is sent as a delta and applied to it
+    SharedTensor tensor = make_ramp({64, 64}, UINT8);
+    publisher.send(tensor);
+
+    if (!wait_for([&]() { return receiver.count == 1; }) || !same(receiver.last, tensor)) {
+        cerr << "Keyframe not reconstructed" << endl;
+        exit(-1);
+    }
+
+    tensor = copy_tensor(tensor);
+    tensor->get_data()[1000] ^= 0xFF;
+    tensor->get_data()[3000] ^= 0xFF;
+    publisher.send(tensor);
+
+    if (!wait_for([&]() { return receiver.count == 2 && inspector.kinds.size() == 2; }) || !same(receiver.last, tensor) ||
+            inspector.kinds[0] != DELTA_KEYFRAME || inspector.kinds[1] != DELTA_UPDATE || inspector.lengths[1] * 4 > inspector.lengths[0]) {
+        cerr << "Delta not reconstructed" << endl;
+        exit(-1);
+    }
+
+    // A subscriber that joins gets a keyframe, the existing one keeps up
+    Receiver joined(late, "delta");
+
+    echolib::wait(100);
+
+    tensor = copy_tensor(tensor);
+    tensor->get_data()[10] ^= 0xFF;
+    publisher.send(tensor);
+
+    if (!wait_for([&]() { return joined.count == 1 && receiver.count == 3 && inspector.kinds.size() == 3; }) ||
+            inspector.kinds[2] != DELTA_KEYFRAME || !same(joined.last, tensor) || !same(receiver.last, tensor)) {
+        cerr << "No keyframe for a new subscriber" << endl;
+        exit(-2);
+    }
+
+    tensor = copy_tensor(tensor);
+    tensor->get_data()[20] ^= 0xFF;
+    publisher.send(tensor);
+
+    if (!wait_for([&]() { return joined.count == 2 && receiver.count == 4; }) || inspector.kinds[3] != DELTA_UPDATE ||
+            !same(joined.last, tensor) || !same(receiver.last, tensor)) {
+        cerr << "Delta after a join not reconstructed" << endl;
+        exit(-2);
+    }
+
+    // A change of shape and a change of type are sent as keyframes
+    tensor = make_ramp({32, 128}, UINT8);
+    publisher.send(tensor);
+
+    if (!wait_for([&]() { return receiver.count == 5 && inspector.kinds.size() == 5; }) || inspector.kinds[4] != DELTA_KEYFRAME ||
+            !same(receiver.last, tensor)) {
+        cerr << "Shape change not sent as a keyframe" << endl;
+        exit(-3);
+    }
+
+    tensor = make_ramp({32, 32}, FLOAT32);
+    publisher.send(tensor);
+
+    if (!wait_for([&]() { return receiver.count == 6 && inspector.kinds.size() == 6; }) || inspector.kinds[5] != DELTA_KEYFRAME ||
+            !same(receiver.last, tensor)) {
+        cerr << "Type change not sent as a keyframe" << endl;
+        exit(-3);
+    }
+
+    // A gap invalidates the state, deltas are ignored until the next keyframe
+    Publisher raw(producer, "gap", DELTA_TENSOR_TYPE);
+    Receiver gapped(consumer, "gap");
+
+    echolib::wait(100);
+
+    size_t length = DELTA_BLOCK_SIZE * 4;
+    SharedTensor base = make_ramp({length}, UINT8);
+
+    raw.send_message(make_raw_keyframe(1, base));
+    raw.send_message(make_raw_delta(2, 1, length, 1));
+
+    if (!wait_for([&]() { return gapped.count == 2; }) || gapped.last->get_data()[0] != 1 || gapped.last->get_data()[DELTA_BLOCK_SIZE] != base->get_data()[DELTA_BLOCK_SIZE]) {
+        cerr << "Raw delta not applied " << gapped.count << endl;
+        exit(-4);
+    }
+
+    // Message 3 is lost, deltas on top of it and after it are not applied
+    raw.send_message(make_raw_delta(4, 3, length, 4));
+    raw.send_message(make_raw_delta(5, 4, length, 5));
+    raw.send_message(make_raw_keyframe(6, base));
+
+    if (!wait_for([&]() { return gapped.count >= 3; }) || gapped.count != 3 || !same(gapped.last, base)) {
+        cerr << "Deltas applied after a gap: " << gapped.count << endl;
+        exit(-4);
+    }
+
+    raw.send_message(make_raw_delta(7, 6, length, 7));
+
+    if (!wait_for([&]() { return gapped.count == 4; }) || gapped.last->get_data()[0] != 7) {
+        cerr << "Delta after a keyframe not applied" << endl;
+        exit(-4);
+    }
+
+    exit(0);
+
+}
@@ -0,0 +1,158 @@
+#include <iostream>
+#include <memory>
+#include <opencv2/opencv.hpp>
+
+#include <echolib/datatypes.h>
+#include <echolib/array.h>
+
+using namespace std;
+using namespace echolib;
+
+static bool released = false;
+
+// A tensor with its own buffer that reports when it is destroyed
+static SharedTensor make_image(size_t height, size_t width) {
+
+    size_t length = height * width * 3;
+    uchar* buffer = new uchar[length];
+
+    for (size_t i = 0; i < length; i++) {
+        buffer[i] = (uchar) (i % 251);
+    }
+
+    released = false;
+
+    return make_shared<Tensor>(initializer_list<size_t>{height, width, 3}, UINT8, buffer, [buffer]() {
+        delete [] buffer;
+        released = true;
+    });
+
+}
+
+static bool check_pixel(const cv::Mat& mat, int y, int x, size_t width) {
+
+    const cv::Vec3b& pixel = mat.at<cv::Vec3b>(y, x);
+    for (int c = 0; c < 3; c++) {
+        if (pixel[c] != (uchar) (((y * width + x) * 3 + c) % 251)) return false;
+    }
+    return true;
+
+}
+
+int main(int argc, char** argv) {
+
+    // A Mat keeps the tensor alive after the last shared pointer to it is gone
+    {
+        SharedTensor tensor = make_image(48, 64);
+        cv::Mat mat = tensor->asMat();
+        tensor.reset();
+
+        if (released || mat.type() != CV_8UC3 || mat.rows != 48 || mat.cols != 64 || !check_pixel(mat, 47, 63, 64)) {
+            cerr << "Mat does not keep the tensor alive" << endl;
+            exit(-1);
+        }
+
+        mat.release();
+
+        if (!released) {
+            cerr << "Tensor not released with the last Mat" << endl;
+            exit(-1);
+        }
+    }
+
+    // Copies and regions of interest share the reference
+    {
+        SharedTensor tensor = make_image(48, 64);
+        cv::Mat mat = tensor->asMat();
+        cv::Mat copy = mat;
+        cv::Mat roi = mat(cv::Rect(8, 4, 16, 12));
+        tensor.reset();
+        mat.release();
+        copy.release();
+
+        if (released || !check_pixel(roi, 11, 15, 64) || roi.at<cv::Vec3b>(0, 0) != cv::Vec3b(((4 * 64 + 8) * 3) % 251,
+                ((4 * 64 + 8) * 3 + 1) % 251, ((4 * 64 + 8) * 3 + 2) % 251)) {
+            cerr << "Region of interest does not keep the tensor alive" << endl;
+            exit(-2);
+        }
+
+        // A clone owns its data
+        cv::Mat clone = roi.clone();
+        roi.release();
+
+        if (!released || clone.rows != 12 || clone.cols != 16) {
+            cerr << "Tensor not released with the last region" << endl;
+            exit(-2);
+        }
+    }
+
+    // Views of a tensor map to strided Mats that keep the parent alive
+    {
+        SharedTensor tensor = make_image(48, 64);
+        cv::Mat mat = tensor->crop({4, 8}, {12, 16})->asMat();
+        tensor.reset();
+
+        if (released || mat.rows != 12 || mat.cols != 16 || mat.isContinuous() || mat.at<cv::Vec3b>(0, 0)[0] != ((4 * 64 + 8) * 3) % 251) {
+            cerr << "Mat of a view does not keep the tensor alive" << endl;
+            exit(-3);
+        }
+
+        mat.release();
+
+        if (!released) {
+            cerr << "Tensor not released with the Mat of a view" << endl;
+            exit(-3);
+        }
+
+        // Strided columns cannot be expressed with Mat steps
+        bool rejected = false;
+        try {
+            make_image(4, 8)->slice(1, 0, 8, 2)->asMat();
+        } catch (runtime_error&) {
+            rejected = true;
+        }
+
+        if (!rejected) {
+            cerr << "Element strides are not rejected" << endl;
+            exit(-3);
+        }
+    }
+
+    // A tensor wrapping a Mat keeps the Mat data alive
+    {
+        SharedTensor tensor;
+        {
+            cv::Mat image(32, 40, CV_8UC3, cv::Scalar(1, 2, 3));
+            tensor = make_shared<Tensor>(image(cv::Rect(4, 2, 8, 6)));
+        }
+
+        if (tensor->ndims() != 3 || tensor->shape(0) != 6 || tensor->shape(1) != 8 || tensor->shape(2) != 3 ||
+                tensor->is_contiguous()) {
+            cerr << "Unexpected shape of a wrapped Mat" << endl;
+            exit(-4);
+        }
+
+        // Gathered into a packed buffer when copied
+        vector<uchar> packed(tensor->get_size());
+        tensor->copy_data(0, packed.data(), packed.size());
+
+        for (size_t i = 0; i < packed.size(); i++) {
+            if (packed[i] != (uchar) (i % 3 + 1)) {
+                cerr << "Wrapped Mat data is not valid" << endl;
+                exit(-4);
+            }
+        }
+
+        // And back, the Mat references the wrapping tensor
+        cv::Mat mat = tensor->asMat();
+        tensor.reset();
+
+        if (mat.rows != 6 || mat.cols != 8 || mat.at<cv::Vec3b>(5, 7) != cv::Vec3b(1, 2, 3)) {
+            cerr << "Mat of a wrapped Mat is not valid" << endl;
+            exit(-4);
+        }
+    }
+
+    exit(0);
+
+}
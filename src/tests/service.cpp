@@ -0,0 +1,162 @@
+#include <iostream>
+#include <memory>
+
+#include <unistd.h>
+
+#include <echolib/client.h>
+#include <echolib/datatypes.h>
+#include <echolib/array.h>
+
+using namespace std;
+using namespace echolib;
+
+typedef TypedService<SharedTensor, SharedTensor> TensorService;
+typedef TypedServiceClient<SharedTensor, SharedTensor> TensorServiceClient;
+
+static SharedTensor make_value(int value) {
+
+    SharedTensor tensor = make_shared<Tensor>(initializer_list<size_t>{4}, INT32);
+    for (size_t i = 0; i < 4; i++) {
+        ((int32_t *) tensor->get_data())[i] = value;
+    }
+    return tensor;
+
+}
+
+static int get_value(const SharedTensor& tensor) {
+
+    return ((int32_t *) tensor->get_data())[0];
+
+}
+
+// Waits until the condition holds, the loop is pumped in small steps
+static bool wait_for(function<bool()> condition, int timeout = 2000) {
+
+    for (int i = 0; i < timeout / 10; i++) {
+        if (condition()) return true;
+        echolib::wait(10);
+    }
+
+    return condition();
+
+}
+
+int main(int argc, char** argv) {
+
+    SharedClient server = echolib::connect();
+    SharedClient first = echolib::connect();
+    SharedClient second = echolib::connect();
+
+    TensorService service(server, "double", [](shared_ptr<SharedTensor> request) {
+        return make_value(get_value(*request) * 2);
+    });
+
+    echolib::wait(100);
+
+    // Responses are routed back to the connection that sent the request
+    TensorServiceClient caller1(first, "double");
+    TensorServiceClient caller2(second, "double");
+
+    int status1 = -1, status2 = -1, result1 = 0, result2 = 0;
+
+    caller1.call(make_value(3), [&](int status, shared_ptr<SharedTensor> response) {
+        status1 = status;
+        if (response) result1 = get_value(*response);
+    });
+
+    caller2.call(make_value(5), [&](int status, shared_ptr<SharedTensor> response) {
+        status2 = status;
+        if (response) result2 = get_value(*response);
+    });
+
+    if (!wait_for([&]() { return status1 >= 0 && status2 >= 0; }) || status1 != ECHO_SERVICE_OK || status2 != ECHO_SERVICE_OK ||
+            result1 != 6 || result2 != 10) {
+        cerr << "Round-trip failed: " << status1 << " " << result1 << ", " << status2 << " " << result2 << endl;
+        exit(-1);
+    }
+
+    // A provider that stops handling requests, its loop is not run after the service is registered
+    SharedIOLoop stalled_loop = make_shared<IOLoop>();
+    SharedClient stalled = echolib::connect(string(), string(), stalled_loop);
+
+    TensorService stuck(stalled, "stuck", [](shared_ptr<SharedTensor> request) {
+        return *request;
+    });
+
+    for (int i = 0; i < 10; i++) stalled_loop->wait(10);
+
+    TensorServiceClient caller3(first, "stuck", 200);
+
+    int status3 = -1;
+
+    caller3.call(make_value(1), [&](int status, shared_ptr<SharedTensor> response) {
+        status3 = status;
+    });
+
+    if (!wait_for([&]() { return status3 >= 0; }) || status3 != ECHO_SERVICE_TIMEOUT || caller3.get_pending() != 0) {
+        cerr << "Expected a timeout, got " << status3 << endl;
+        exit(-2);
+    }
+
+    // An ordinary channel that is in use cannot be called as a service
+    TypedPublisher<SharedTensor> publisher(second, "ordinary");
+
+    echolib::wait(100);
+
+    TensorServiceClient caller4(first, "ordinary");
+
+    int status4 = -1;
+
+    caller4.call(make_value(1), [&](int status, shared_ptr<SharedTensor> response) {
+        status4 = status;
+    });
+
+    if (!wait_for([&]() { return status4 >= 0; }) || status4 != ECHO_SERVICE_UNAVAILABLE) {
+        cerr << "Expected an unavailable service, got " << status4 << endl;
+        exit(-3);
+    }
+
+    // A connection can call a service that it provides itself
+    TensorService own(first, "triple", [](shared_ptr<SharedTensor> request) {
+        return make_value(get_value(*request) * 3);
+    });
+
+    echolib::wait(100);
+
+    TensorServiceClient caller5(first, "triple");
+
+    int status5 = -1, result5 = 0;
+
+    caller5.call(make_value(7), [&](int status, shared_ptr<SharedTensor> response) {
+        status5 = status;
+        if (response) result5 = get_value(*response);
+    });
+
+    if (!wait_for([&]() { return status5 >= 0; }) || status5 != ECHO_SERVICE_OK || result5 != 21) {
+        cerr << "Call on the providing connection failed: " << status5 << " " << result5 << endl;
+        exit(-4);
+    }
+
+    // A loop that waits without a timeout still wakes up for the deadline of a request
+    SharedIOLoop blocking_loop = make_shared<IOLoop>();
+    SharedClient blocking = echolib::connect(string(), string(), blocking_loop);
+
+    TensorServiceClient caller6(blocking, "stuck", 200);
+
+    caller6.call(make_value(1), [&](int status, shared_ptr<SharedTensor> response) {
+        if (status != ECHO_SERVICE_TIMEOUT) {
+            cerr << "Expected a timeout while blocking, got " << status << endl;
+            exit(-5);
+        }
+        exit(0);
+    });
+
+    // The wait does not return, the callback ends the test and the alarm fails it if the callback is never called
+    alarm(5);
+
+    blocking_loop->wait();
+
+    cerr << "Blocking wait returned without a timeout" << endl;
+    exit(-5);
+
+}
@@ -0,0 +1,155 @@
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <random>
+#include <cstring>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include <echolib/message.h>
+
+using namespace std;
+using namespace echolib;
+
+static SharedMessage make_message(size_t length, bool random) {
+
+    shared_ptr<BufferedMessage> message = make_shared<BufferedMessage>((int) length);
+    uchar* data = message->get_buffer();
+
+    std::mt19937 generator(42);
+    for (size_t i = 0; i < length; i++) {
+        data[i] = random ? (uchar) generator() : (uchar) ((i / 64) % 7);
+    }
+
+    return message;
+
+}
+
+static bool same(const SharedMessage& a, const SharedMessage& b) {
+
+    if (!a || !b || a->get_length() != b->get_length()) return false;
+
+    vector<uchar> da(a->get_length()), db(b->get_length());
+    a->copy_data(0, da.data(), da.size());
+    b->copy_data(0, db.data(), db.size());
+
+    return da == db;
+
+}
+
+// Writes and reads in turns until a message arrives, the sockets are non-blocking
+static SharedMessage transfer(StreamWriter& writer, StreamReader& reader) {
+
+    for (int i = 0; i < 10000; i++) {
+        writer.write_messages();
+        SharedMessage message = reader.read_message();
+        if (message || reader.get_error()) return message;
+    }
+
+    return SharedMessage();
+
+}
+
+static void open_pair(int fds[2]) {
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        cerr << "Cannot create a socket pair" << endl;
+        exit(-1);
+    }
+
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+
+}
+
+int main(int argc, char** argv) {
+
+    int codec = get_stream_codec("zlib");
+
+    if (codec == STREAM_CODEC_NONE) {
+        cerr << "Built without zlib, skipping" << endl;
+        exit(0);
+    }
+
+    int first[2], second[2];
+    open_pair(first);
+    open_pair(second);
+
+    StreamWriter writer1(first[0]), writer2(second[0]);
+    StreamReader reader1(first[1]), reader2(second[1]);
+
+    writer1.set_compression(codec);
+    writer2.set_compression(codec);
+
+    // Compressible data is sent compressed and restored, messages are at most MESSAGE_MAX_SIZE long
+    SharedMessage patterned = make_message(48 * 1024, false);
+
+    writer1.add_message(patterned, 0);
+    SharedMessage received = transfer(writer1, reader1);
+
+    CompressionStatistics sent = writer1.get_compression_statistics();
+
+    if (!same(received, patterned) || sent.messages != 1 || sent.compressed_bytes * 10 > sent.raw_bytes ||
+            reader1.get_compression_statistics().messages != 1) {
+        cerr << "Compressible message not transferred compressed" << endl;
+        exit(-1);
+    }
+
+    // The same message on another connection reuses the compressed form
+    writer2.add_message(patterned, 0);
+    received = transfer(writer2, reader2);
+
+    if (!same(received, patterned) || writer2.get_compression_statistics().messages != 1 ||
+            writer2.get_compression_statistics().compressed_bytes != sent.compressed_bytes || writer2.get_compression_statistics().time != 0) {
+        cerr << "Compressed form not reused" << endl;
+        exit(-1);
+    }
+
+    // Incompressible data is sent as it is
+    SharedMessage noise = make_message(32 * 1024, true);
+
+    writer1.add_message(noise, 0);
+    received = transfer(writer1, reader1);
+
+    if (!same(received, noise) || writer1.get_compression_statistics().skipped != 1 ||
+            writer1.get_compression_statistics().messages != 1 || reader1.get_compression_statistics().messages != 1) {
+        cerr << "Incompressible message not sent as it is" << endl;
+        exit(-2);
+    }
+
+    // And is not compressed again for another connection
+    uint64_t time = writer2.get_compression_statistics().time;
+
+    writer2.add_message(noise, 0);
+    received = transfer(writer2, reader2);
+
+    if (!same(received, noise) || writer2.get_compression_statistics().skipped != 1 || writer2.get_compression_statistics().time != time) {
+        cerr << "Incompressible message compressed again" << endl;
+        exit(-2);
+    }
+
+    // A compressed frame that does not decompress is an error
+    uchar frame[] = {0x0E, 0, 0, 0, 13, (uchar) codec, 0, 0, 4, 0, 'n', 'o', 't', ' ', 'z', 'l', 'i', 'b'};
+
+    if (write(first[0], frame, sizeof(frame)) != (ssize_t) sizeof(frame)) {
+        cerr << "Cannot write a frame" << endl;
+        exit(-3);
+    }
+
+    received = reader1.read_message();
+
+    if (received || reader1.get_error() != -6) {
+        cerr << "Corrupt frame not rejected: " << reader1.get_error() << endl;
+        exit(-3);
+    }
+
+    close(first[0]);
+    close(first[1]);
+    close(second[0]);
+    close(second[1]);
+
+    exit(0);
+
+}
@@ -4,6 +4,9 @@
 #include <iostream>
 #include <fstream>
 #include <memory>
+#include <cmath>
+#include <cstring>
+#include <limits>
 
 #include <echolib/client.h>
 #include <echolib/datatypes.h>
@@ -39,10 +42,154 @@ void handle_frame(shared_ptr<SharedTensor> data) {
 
 }
 
+static uint32_t float_bits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static bool check(bool condition, const string& message) {
+    if (!condition) cerr << "Conversion check failed: " << message << endl;
+    return condition;
+}
+
+// Half and bfloat16 conversions have to round to nearest even and handle subnormals and infinities, the vectorized
+// path (eight or more values) and the scalar path (single values) have to give identical results
+bool check_conversions() {
+
+    bool ok = true;
+    float inf = std::numeric_limits<float>::infinity();
+
+    vector<pair<float, uint16_t>> half_cases = {
+        {1.0f, 0x3C00}, {-2.0f, 0xC000}, {0.0f, 0x0000}, {-0.0f, 0x8000}, {65504.0f, 0x7BFF}, {65520.0f, 0x7C00},
+        {inf, 0x7C00}, {-inf, 0xFC00}, {ldexpf(1, -14), 0x0400}, {ldexpf(1, -24), 0x0001}, {ldexpf(1, -25), 0x0000},
+        {ldexpf(3, -26), 0x0001}, {ldexpf(1023, -24), 0x03FF}, {1.0f + ldexpf(1, -11), 0x3C00},
+        {1.0f + ldexpf(3, -11), 0x3C02}, {1.0f + ldexpf(1, -11) + ldexpf(1, -20), 0x3C01}
+    };
+
+    vector<float> values;
+    for (auto c : half_cases) values.push_back(c.first);
+
+    vector<uint16_t> batch(values.size());
+    convert_float32_to_float16(values.data(), batch.data(), values.size());
+
+    for (size_t i = 0; i < half_cases.size(); i++) {
+        uint16_t single;
+        convert_float32_to_float16(&values[i], &single, 1);
+        ok &= check(batch[i] == half_cases[i].second && single == half_cases[i].second, "float16 case " + to_string(i));
+    }
+
+    float nan = std::numeric_limits<float>::quiet_NaN();
+    vector<float> nans(8, nan);
+    vector<uint16_t> half_nans(8);
+    convert_float32_to_float16(nans.data(), half_nans.data(), 8);
+    ok &= check((half_nans[0] & 0x7C00) == 0x7C00 && (half_nans[0] & 0x03FF) != 0, "float16 NaN");
+
+    // Every half value converts to float and back unchanged, in both paths
+    vector<uint16_t> halves(65536);
+    for (size_t i = 0; i < halves.size(); i++) halves[i] = (uint16_t) i;
+    vector<float> widened(65536);
+    convert_float16_to_float32(halves.data(), widened.data(), halves.size());
+    vector<uint16_t> narrowed(65536);
+    convert_float32_to_float16(widened.data(), narrowed.data(), widened.size());
+
+    for (size_t i = 0; i < halves.size(); i++) {
+        float single;
+        convert_float16_to_float32(&halves[i], &single, 1);
+        bool is_nan = ((i & 0x7C00) == 0x7C00) && (i & 0x03FF);
+        if (is_nan) {
+            ok &= check(std::isnan(widened[i]) && std::isnan(single), "float16 NaN widening " + to_string(i));
+            continue;
+        }
+        if (!check(float_bits(single) == float_bits(widened[i]) && narrowed[i] == halves[i], "float16 round-trip " + to_string(i))) {
+            ok = false;
+            break;
+        }
+    }
+
+    ok &= check(widened[0x0001] == ldexpf(1, -24) && widened[0x7C00] == inf && widened[0xFC00] == -inf, "float16 widening");
+
+    vector<pair<float, uint16_t>> bfloat_cases = {
+        {1.0f, 0x3F80}, {-2.0f, 0xC000}, {1.0f + ldexpf(1, -8), 0x3F80}, {1.0f + ldexpf(3, -8), 0x3F82},
+        {inf, 0x7F80}, {-inf, 0xFF80}, {ldexpf(1, -133), 0x0001}, {ldexpf(1, -149), 0x0000},
+        {std::numeric_limits<float>::max(), 0x7F80}
+    };
+
+    for (size_t i = 0; i < bfloat_cases.size(); i++) {
+        uint16_t single;
+        convert_float32_to_bfloat16(&bfloat_cases[i].first, &single, 1);
+        ok &= check(single == bfloat_cases[i].second, "bfloat16 case " + to_string(i));
+    }
+
+    uint16_t bfloat_nan;
+    convert_float32_to_bfloat16(&nan, &bfloat_nan, 1);
+    ok &= check((bfloat_nan & 0x7F80) == 0x7F80 && (bfloat_nan & 0x007F) != 0, "bfloat16 NaN");
+
+    // Tensor conversions go through the same functions
+    SharedTensor floats = make_shared<Tensor>(initializer_list<size_t>{2, 8}, FLOAT32);
+    for (size_t i = 0; i < 16; i++) ((float *) floats->get_data())[i] = (float) i * 0.25f - 2.0f;
+    SharedTensor restored = floats->convert(BFLOAT16)->convert(FLOAT32);
+    ok &= check(restored->get_type() == FLOAT32 && memcmp(restored->get_data(), floats->get_data(), floats->get_size()) == 0, "bfloat16 tensor");
+    restored = floats->convert(FLOAT16)->convert(FLOAT32);
+    ok &= check(memcmp(restored->get_data(), floats->get_data(), floats->get_size()) == 0, "float16 tensor");
+
+    // Bits are packed most significant first, the last byte is padded with zeros
+    uint8_t flags[] = {1, 0, 1, 1, 0, 0, 0, 0, 1, 1};
+    SharedTensor bools = make_shared<Tensor>(initializer_list<size_t>{10}, BOOL);
+    memcpy(bools->get_data(), flags, sizeof(flags));
+
+    SharedTensor bits = bools->convert(BIT);
+    ok &= check(bits->get_size() == 2 && bits->get_data()[0] == 0xB0 && bits->get_data()[1] == 0xC0, "BIT packing");
+
+    SharedTensor unpacked = bits->convert(BOOL);
+    ok &= check(unpacked->get_size() == 10 && memcmp(unpacked->get_data(), flags, sizeof(flags)) == 0, "BIT unpacking");
+
+    return ok;
+}
+
+// Tensors larger than a chunk are reassembled into a contiguous message, an aliasing reader references its data
+bool check_chunked(SharedClient client) {
+
+    SharedTensor large = make_shared<Tensor>(initializer_list<size_t>{256, 256}, FLOAT32);
+    for (size_t i = 0; i < large->get_size(); i++) large->get_data()[i] = (uchar) (i % 251);
+
+    bool received = false, ok = false;
+
+    TypedPublisher<SharedTensor> publisher(client, "large");
+    Subscriber subscriber(client, "large", get_type_identifier<SharedTensor>(), create_data_callback([&](SharedMessage message) {
+        received = true;
+
+        size_t length = 0;
+        const uchar* span = message->get_span(0, length);
+
+        MessageReader reader(message, true);
+        SharedTensor tensor;
+        read(reader, tensor);
+
+        ok = check(span && length == message->get_length(), "chunked message not contiguous") &&
+            check(tensor->get_data() >= span && tensor->get_data() + tensor->get_size() <= span + length, "chunked tensor not aliased") &&
+            check(((uintptr_t) tensor->get_data()) % TENSOR_DATA_ALIGNMENT == 0, "chunked tensor not aligned") &&
+            check(tensor->get_size() == large->get_size() && memcmp(tensor->get_data(), large->get_data(), large->get_size()) == 0, "chunked tensor changed");
+    }));
+
+    for (int i = 0; i < 50 && !received; i++) {
+        publisher.send(large);
+        echolib::wait(100);
+    }
+
+    return check(received, "chunked tensor not received") && ok;
+}
+
 int main(int argc, char** argv) {
 
+    if (!check_conversions())
+        exit(-3);
+
     SharedClient client = echolib::connect();
 
+    if (!check_chunked(client))
+        exit(-4);
+
     frame = make_shared<Tensor>(initializer_list<size_t>{100, 100}, UINT8);
 
 	uint8_t* data = (uint8_t *) frame->get_data();